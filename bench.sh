@@ -0,0 +1,172 @@
+#!/bin/bash
+#########################################################
+# Program: tcpping - Utility for TCP based ping.        #
+# Author:  Joseph Colton <josephcolton@gmail.com>       #
+# License: GNU General Public License 3.0               #
+#          https://www.gnu.org/licenses/gpl-3.0.en.html #
+#########################################################
+#
+# Benchmark suite, run by "make bench".
+#
+# 1. Throughput: pings a local --listen responder over loopback with 1,
+#    1k and 100k targets and reports probes/sec, CPU time per probe and
+#    peak RSS, which has to stay within a budget per target count.
+# 2. Accuracy (root only): pings a responder in a network namespace
+#    behind a veth pair shaped by tc netem, and checks the measured
+#    min/ave/p50 and loss against each configured profile.
+#
+# Exits non-zero if a run fails, uses too much memory or a measurement
+# is out of bounds.
+
+TCPPING=${TCPPING:-./tcpping}
+PORT=${BENCH_PORT:-7407}
+NS=tcpping-bench
+DIR=$(mktemp -d)
+
+# Peak RSS allowed: a fixed part for the probe engine and result rings,
+# plus the 528 byte table entry of every target with its name, and the
+# 3.7 KB rtt histogram it allocates on its first answer, as all do here
+RSS_BASE_MB=32
+RSS_ENTRY_KB=0.6
+RSS_HIST_KB=3.7
+
+# Accuracy profiles: name, delay ms, jitter ms, loss percent
+PROFILES="
+delay10  10 0 0
+jitter20 20 4 0
+loss5    5  0 5
+"
+
+cleanup() {
+  [ -n "$LISTENER" ] && kill -INT $LISTENER 2>/dev/null && wait $LISTENER 2>/dev/null
+  [ -n "$SHAPED" ] && kill -INT $SHAPED 2>/dev/null && wait $SHAPED 2>/dev/null
+  ip link del tcpb0 2>/dev/null
+  ip netns del $NS 2>/dev/null
+  rm -rf "$DIR"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Failures are kept in a file, so those found in a pipeline count too
+fail() {
+  echo "FAIL: $*"
+  touch "$DIR/failed"
+}
+
+# Run tcpping with the given arguments, keeping its output in $DIR/out
+# and setting PROBES, SECS, CPU_US (per probe) and RSS_MB.
+measure() {
+  local start end sub pid hwm=0 key value
+
+  rm -f "$DIR/pid" "$DIR/rc"
+  start=$(date +%s%N)
+  # The subshell's times then cover tcpping alone
+  ( "$TCPPING" "$@" > "$DIR/out" 2>&1 &
+    echo $! > "$DIR/pid"
+    wait $!
+    echo $? > "$DIR/rc"
+    times > "$DIR/times" ) &
+  sub=$!
+  while [ ! -s "$DIR/pid" ]; do sleep 0.01; done
+  pid=$(cat "$DIR/pid")
+  # VmHWM only grows, so the last reading before exit is the peak
+  while kill -0 $pid 2>/dev/null; do
+    while read -r key value _; do
+      [ "$key" = VmHWM: ] && hwm=$value
+    done < /proc/$pid/status 2>/dev/null
+    sleep 0.05
+  done
+  wait $sub
+  end=$(date +%s%N)
+  [ "$(cat "$DIR/rc")" = 0 ] || fail "tcpping $* exited with $(cat "$DIR/rc")"
+  PROBES=$(awk '/ pings, / {n += $1} /^Pings: / {n += $2} END {print n + 0}' "$DIR/out")
+  SECS=$(awk -v a=$start -v b=$end 'BEGIN {printf "%.3f", (b - a) / 1e9}')
+  # Second line of times is the children's user and system time, as 0m1.234s
+  CPU_US=$(awk -v p=$PROBES 'NR == 2 {split($1, u, "m"); split($2, s, "m"); t = (u[1] * 60 + u[2] + s[1] * 60 + s[2]) * 1e6}
+                             END {printf "%.2f", p ? t / p : 0}' "$DIR/times")
+  RSS_MB=$(awk -v k=$hwm 'BEGIN {printf "%.1f", k / 1024}')
+}
+
+# Write N loopback targets, spread over 127.1.0.0/16 and up
+targets() {
+  awk -v n=$1 -v port=$PORT 'BEGIN {for (i = 0; i < n; i++) printf "127.%d.%d.%d:%d\n", 1 + int(i / 65536), int(i / 256) % 256, i % 256, port}' > "$DIR/targets"
+}
+
+if [ ! -x "$TCPPING" ]; then
+  echo "No $TCPPING, run make first."
+  exit 1
+fi
+ulimit -n 65536 2>/dev/null
+
+echo "=== Throughput over loopback ==="
+# The listener closes with a FIN: a RST can beat the client to noticing
+# its connection is up, and would count as refused
+"$TCPPING" --listen $PORT -d stat > "$DIR/listener" 2>&1 &
+LISTENER=$!
+sleep 0.5
+kill -0 $LISTENER 2>/dev/null || { cat "$DIR/listener"; exit 1; }
+for run in "1 0.0001 20000" "1000 0.01 200" "100000 1 3"; do
+  set -- $run
+  targets $1
+  measure -T "$DIR/targets" -i $2 -c $3 -t 1 --close rst -d clean
+  # Clean mode gives one Loss: line per target
+  LOSS=$(awk '/^Loss: / {s += $2; n++} END {printf "%.1f", n ? s / n : 0}' "$DIR/out")
+  BUDGET=$(awk -v n=$1 -v b=$RSS_BASE_MB -v e=$RSS_ENTRY_KB -v h=$RSS_HIST_KB 'BEGIN {printf "%.1f", b + n * (e + h) / 1024}')
+  printf "targets=%-6s probes=%-7s time=%ss rate=%.0f/s cpu=%sus/probe rss=%sMB (budget %sMB) loss=%s%%\n" \
+         $1 $PROBES $SECS $(awk -v p=$PROBES -v s=$SECS 'BEGIN {print (s > 0 ? p / s : 0)}') $CPU_US $RSS_MB $BUDGET $LOSS
+  [ "$PROBES" -gt 0 ] || fail "no pings recorded with $1 targets"
+  awk -v r=$RSS_MB -v b=$BUDGET 'BEGIN {exit !(r <= b)}' || fail "peak RSS of ${RSS_MB}MB with $1 targets is over budget"
+done
+kill -INT $LISTENER
+wait $LISTENER 2>/dev/null
+LISTENER=
+
+echo
+echo "=== Accuracy through netem ==="
+if [ "$(id -u)" != 0 ]; then
+  echo "SKIP: needs root for namespaces and tc"
+  [ ! -f "$DIR/failed" ]
+  exit
+fi
+ip netns add $NS &&
+  ip link add tcpb0 type veth peer name tcpb1 &&
+  ip link set tcpb1 netns $NS &&
+  ip addr add 10.203.0.1/30 dev tcpb0 &&
+  ip link set tcpb0 up &&
+  ip -n $NS addr add 10.203.0.2/30 dev tcpb1 &&
+  ip -n $NS link set tcpb1 up &&
+  ip -n $NS link set lo up || { echo "FAIL: cannot set up namespace $NS"; exit 1; }
+if ! tc qdisc add dev tcpb0 root netem delay 1ms 2>/dev/null; then
+  echo "SKIP: tc netem is not available in this kernel"
+  [ ! -f "$DIR/failed" ]
+  exit
+fi
+ip netns exec $NS "$TCPPING" --listen 10.203.0.2:$PORT -j 1 -d stat > "$DIR/shaped" 2>&1 &
+SHAPED=$!
+sleep 0.5
+
+echo "$PROFILES" | while read name delay jitter loss; do
+  [ -n "$name" ] || continue
+  # Only the SYN direction is shaped, so the rtt is the delay plus the veth itself
+  if [ "$loss" = 0 ]; then
+    tc qdisc change dev tcpb0 root netem delay ${delay}ms ${jitter}ms
+  else
+    tc qdisc change dev tcpb0 root netem delay ${delay}ms ${jitter}ms loss ${loss}%
+  fi
+  measure -c 400 -i 0.01 -t 1 --close rst -d clean -p $PORT 10.203.0.2
+  awk -v name=$name -v d=$delay -v j=$jitter -v l=$loss '
+    /^Min: / {min = $2} /^Ave: / {ave = $2} /^P50: / {p50 = $2} /^P99: / {p99 = $2} /^Loss: / {loss = $2}
+    END {
+      # Slack for the veth, scheduling and the clock: 5% of the delay, at least 0.5 ms
+      slack = d * 0.05 > 0.5 ? d * 0.05 : 0.5
+      # Loss is binomial over 400 pings, in percent; allow four standard deviations
+      sd = sqrt(l * (100 - l) / 400)
+      ok = min >= d - j - slack && ave >= d - slack && ave <= d + j / 2 + slack &&
+           p50 >= d - j / 2 - slack && p50 <= d + j / 2 + slack &&
+           loss >= l - 4 * sd - 0.5 && loss <= l + 4 * sd + 0.5
+      printf "%-8s delay=%sms jitter=%sms loss=%s%%: min/ave/p50/p99 = %.3f/%.3f/%.3f/%.3f ms loss=%.1f%% %s\n",
+             name, d, j, l, min, ave, p50, p99, loss, ok ? "ok" : "OUT OF BOUNDS"
+      exit !ok
+    }' "$DIR/out" || fail "$name is out of bounds"
+done
+[ ! -f "$DIR/failed" ]
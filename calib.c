@@ -0,0 +1,131 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#define _GNU_SOURCE      // accept4
+#include <stdlib.h>      // qsort
+#include <string.h>      // memset
+#include <errno.h>       // errno
+#include <unistd.h>      // close
+#include <sys/socket.h>  // socket, accept4
+#include <arpa/inet.h>   // htonl
+#include "calib.h"
+#include "syn.h"
+
+// Handshakes seen so far by calib_run()
+struct calib_state {
+  int64_t *samples;  // Successful rtts
+  int n;             // Samples held
+  boolean done;      // The last probe has finished
+};
+
+/*****************************************
+ * on_calib - Keep the rtt of a finished *
+ *            calibration probe          *
+ *****************************************/
+static void on_calib(struct engine *eng, const struct probe_result *res, void *ctx) {
+  struct calib_state *st = ctx;
+  st->done = TRUE;
+  if (res->outcome == PROBE_OK) st->samples[st->n++] = res->rtt_ns;
+}
+
+/********************************************
+ * compare_ns - qsort order for nanoseconds *
+ ********************************************/
+static int compare_ns(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/********************************************************
+ * calib_run - Measure the floor of an rtt on this host *
+ *                                                      *
+ * Times back to back clock reads, then pings a         *
+ * listener on 127.0.0.1 CALIB_PROBES times through eng *
+ * with its own mode and options (but no hello).  Each  *
+ * probe waits gap_ns (at most CALIB_GAP_NS) after the  *
+ * last, so the thread has gone to sleep as it would    *
+ * between real pings and its wakeup is counted.  The   *
+ * engine's callback is borrowed for the run, so eng    *
+ * must be idle.                                        *
+ * Returns 0 on success, -1 with errno set if no        *
+ * handshake completed.                                 *
+ ********************************************************/
+int calib_run(struct calibration *c, struct engine *eng, int64_t gap_ns) {
+  int64_t samples[CALIB_READS > CALIB_PROBES ? CALIB_READS : CALIB_PROBES];
+  struct calib_state st = { samples, 0, FALSE };
+  union sockaddr_any addr, source;
+  socklen_t len = sizeof(addr.in4);
+  result_fn saved_fn = eng->on_result;
+  void *saved_ctx = eng->ctx;
+  hello_mode saved_hello = eng->hello;
+  int64_t t0, until;
+  int fd, conn, i;
+
+  memset(c, 0, sizeof(*c));
+  for (i = 0; i < CALIB_READS; i++) {
+    t0 = clock_ns();
+    samples[i] = clock_ns() - t0;
+  }
+  qsort(samples, CALIB_READS, sizeof(int64_t), compare_ns);
+  c->clock_ns = samples[CALIB_READS / 2];
+
+  // A listener on a port of the kernel's choosing
+  memset(&addr, 0, sizeof(addr));
+  addr.in4.sin_family = AF_INET;
+  addr.in4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (bind(fd, &addr.sa, sizeof(addr.in4)) < 0 || listen(fd, CALIB_PROBES) < 0 ||
+      getsockname(fd, &addr.sa, &len) < 0 || (eng->syn && syn_route(&addr, &source) < 0)) {
+    i = errno;
+    close(fd);
+    errno = i;
+    return -1;
+  }
+
+  eng->on_result = on_calib;
+  eng->ctx = &st;
+  eng->hello = HELLO_NONE;
+  if (gap_ns > CALIB_GAP_NS) gap_ns = CALIB_GAP_NS;
+  for (i = 0; i < CALIB_PROBES && !terminate; i++) {
+    st.done = FALSE;
+    if (i && gap_ns > 0) engine_poll(eng, clock_ns() + gap_ns);
+    if (engine_probe(eng, &addr, &source, 0, i + 1, CALIB_WAIT_NS) < 0) break;
+    until = clock_ns() + CALIB_WAIT_NS;
+    while (!st.done && clock_ns() < until) engine_poll(eng, until);
+    // Nothing is ever said on these, so close them as they come
+    while ((conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) close(conn);
+  }
+  eng->on_result = saved_fn;
+  eng->ctx = saved_ctx;
+  eng->hello = saved_hello;
+  close(fd);
+
+  if (st.n == 0) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+  qsort(samples, st.n, sizeof(int64_t), compare_ns);
+  c->probes = st.n;
+  c->floor_ns = samples[0];
+  c->median_ns = samples[st.n / 2];
+  c->p90_ns = samples[st.n * 9 / 10];
+  return 0;
+}
+
+/*******************************************************
+ * calib_error - Most a measured rtt overstates the    *
+ *               network by, nine times in ten         *
+ *                                                     *
+ * tcpping's own part of an rtt lies between the floor *
+ * and the 90th percentile of the calibration; with    *
+ * the floor subtracted only the spread above it is    *
+ * left.                                               *
+ *******************************************************/
+int64_t calib_error(const struct calibration *c, boolean subtract) {
+  return subtract ? c->p90_ns - c->floor_ns : c->p90_ns;
+}
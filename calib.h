@@ -0,0 +1,40 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stdint.h> // int64_t
+#include "tcpping.h"
+#include "engine.h"
+
+#define CALIB_PROBES 200         // Loopback handshakes timed
+#define CALIB_READS  1000        // Back to back clock reads timed
+#define CALIB_WAIT_NS 1000000000LL // Longest wait for one handshake
+#define CALIB_GAP_NS  2000000LL  // Most idle time between handshakes
+
+/****************************************************
+ * calibration - What tcpping itself adds to an rtt *
+ *                                                  *
+ * A handshake with a listener on loopback has next *
+ * to no network in it, so its time is the floor of *
+ * what the probe engine can measure on this host:  *
+ * clock reads, system calls, the kernel's own work *
+ * and the wakeup from epoll_wait().                *
+ ****************************************************/
+struct calibration {
+  int64_t clock_ns;  // Median cost of one clock read
+  int64_t floor_ns;  // Fastest loopback handshake
+  int64_t median_ns; // Median loopback handshake
+  int64_t p90_ns;    // 90th percentile loopback handshake
+  int probes;        // Handshakes that completed
+};
+
+int calib_run(struct calibration *c, struct engine *eng, int64_t gap_ns);
+int64_t calib_error(const struct calibration *c, boolean subtract);
+
+#endif
@@ -0,0 +1,577 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdio.h>       // FILE
+#include <stdlib.h>      // calloc
+#include <unistd.h>      // close
+#include <string.h>      // memcpy
+#include <ctype.h>       // tolower
+#include <poll.h>        // poll
+#include <sys/socket.h>  // socket
+#include <sys/random.h>  // getrandom
+#include <arpa/inet.h>   // inet_pton
+#include "dns.h"
+
+#define DNS_PORT     53
+#define DNS_TYPE_A    1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN  1
+#define DNS_RETRY_NS  (1 * NSEC_PER_SEC)  // Wait before sending a query again
+#define DNS_FAIL_NS   (30 * NSEC_PER_SEC) // Wait after a failed refresh
+#define DNS_MIN_TTL   1                   // Seconds an answer is kept at least
+#define DNS_MAX_TTL   86400               // Seconds an answer is kept at most
+#define DNS_MSG_LEN   512                 // Largest UDP message without EDNS
+
+// Query ids hold the record type bit, the lookup index and random salt above
+#define QUERY_ID(salt, idx, bit) ((uint16_t)(((salt) * DNS_INFLIGHT + (idx)) << 1 | (bit)))
+
+/***************************************************
+ * dns_parse_server - Read ADDR, ADDR:PORT or      *
+ *                    [ADDR]:PORT                  *
+ *                                                 *
+ * Returns 0 on success, -1 if it is not a numeric *
+ * IPv4 or IPv6 address with an optional port.     *
+ ***************************************************/
+int dns_parse_server(const char *str, union sockaddr_any *addr) {
+  char buf[64];
+  char *host = buf, *port_str = NULL, *end;
+  long port = DNS_PORT;
+
+  if (strlen(str) >= sizeof(buf)) return -1;
+  strcpy(buf, str);
+  if (*host == '[') {
+    if ((end = strchr(host, ']')) == NULL || (end[1] && end[1] != ':')) return -1;
+    if (end[1]) port_str = end + 2;
+    *end = 0;
+    host++;
+  } else if ((end = strchr(host, ':')) != NULL && strchr(end + 1, ':') == NULL) {
+    *end = 0;
+    port_str = end + 1;
+  }
+  if (port_str) {
+    port = strtol(port_str, &end, 10);
+    if (!isdigit((unsigned char)*port_str) || *end || port < 1 || port > 65535) return -1;
+  }
+
+  memset(addr, 0, sizeof(*addr));
+  if (inet_pton(AF_INET, host, &addr->in4.sin_addr) == 1) {
+    addr->in4.sin_family = AF_INET;
+    addr->in4.sin_port = htons(port);
+  } else if (inet_pton(AF_INET6, host, &addr->in6.sin6_addr) == 1) {
+    addr->in6.sin6_family = AF_INET6;
+    addr->in6.sin6_port = htons(port);
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/****************************************************
+ * system_server - First name server in resolv.conf *
+ *                                                  *
+ * Returns 0 on success, -1 when there is none.     *
+ ****************************************************/
+static int system_server(union sockaddr_any *addr) {
+  FILE *file;
+  char line[256], ns[64];
+  int status = -1;
+
+  if ((file = fopen("/etc/resolv.conf", "r")) == NULL) return -1;
+  // Scoped link-local servers (fe80::1%eth0) are passed over
+  while (status < 0 && fgets(line, sizeof(line), file)) {
+    if (sscanf(line, " nameserver %63s", ns) == 1 && strchr(ns, '%') == NULL)
+      status = dns_parse_server(ns, addr);
+  }
+  fclose(file);
+  return status;
+}
+
+/******************************************
+ * name_hash - FNV-1a hash of a lowercase *
+ *             name                       *
+ ******************************************/
+static uint32_t name_hash(const char *name) {
+  uint32_t h = 2166136261u;
+  while (*name) {
+    h ^= (uint8_t)*name++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/**************************************************
+ * find_entry - Index of a cached name, -1 if the *
+ *              name is not in the cache          *
+ **************************************************/
+static int find_entry(const struct dns_resolver *r, const char *name) {
+  uint32_t i;
+  int idx;
+
+  if (r->hash_size == 0) return -1;
+  for (i = name_hash(name) & (r->hash_size - 1); (idx = r->hash[i]) >= 0; i = (i + 1) & (r->hash_size - 1)) {
+    if (strcmp(r->names + r->entries[idx].name, name) == 0) return idx;
+  }
+  return -1;
+}
+
+/***************************************************
+ * add_entry - Put a new name in the cache         *
+ *                                                 *
+ * The hash index is rebuilt whenever it gets half *
+ * full.  Returns the new entry, -1 when out of    *
+ * memory.                                         *
+ ***************************************************/
+static int add_entry(struct dns_resolver *r, const char *name) {
+  struct dns_entry *e;
+  size_t len = strlen(name) + 1;
+  void *grown;
+  int size, i, *hash;
+  uint32_t j;
+
+  if (r->count == r->size) {
+    size = r->size ? r->size * 2 : 64;
+    if ((grown = realloc(r->entries, size * sizeof(struct dns_entry))) == NULL) return -1;
+    r->entries = grown;
+    if ((grown = realloc(r->queue, size * sizeof(int))) == NULL) return -1;
+    r->queue = grown;
+    r->size = size;
+  }
+  if (r->names_len + len > r->names_size) {
+    size_t names_size = r->names_size ? r->names_size * 2 : 4096;
+    while (names_size < r->names_len + len) names_size *= 2;
+    if ((grown = realloc(r->names, names_size)) == NULL) return -1;
+    r->names = grown;
+    r->names_size = names_size;
+  }
+  if ((r->count + 1) * 2 > r->hash_size) {
+    size = r->hash_size ? r->hash_size * 2 : 128;
+    if ((hash = malloc(size * sizeof(int))) == NULL) return -1;
+    for (i = 0; i < size; i++) hash[i] = -1;
+    for (i = 0; i < r->count; i++) {
+      for (j = name_hash(r->names + r->entries[i].name) & (size - 1); hash[j] >= 0; j = (j + 1) & (size - 1));
+      hash[j] = i;
+    }
+    free(r->hash);
+    r->hash = hash;
+    r->hash_size = size;
+  }
+
+  e = &r->entries[r->count];
+  memset(e, 0, sizeof(*e));
+  e->name = r->names_len;
+  e->targets = -1;
+  e->expires_ns = INT64_MAX;
+  memcpy(r->names + r->names_len, name, len);
+  r->names_len += len;
+  for (j = name_hash(name) & (r->hash_size - 1); r->hash[j] >= 0; j = (j + 1) & (r->hash_size - 1));
+  r->hash[j] = r->count;
+  return r->count++;
+}
+
+/*****************************************************
+ * lower_name - Copy a name in lowercase without any *
+ *              trailing dot                         *
+ *                                                   *
+ * Returns 0 on success, -1 if the name is too long. *
+ *****************************************************/
+static int lower_name(const char *name, char *out, size_t size) {
+  size_t i, len = strlen(name);
+
+  if (len && name[len - 1] == '.') len--;
+  if (len == 0 || len >= size) return -1;
+  for (i = 0; i < len; i++) out[i] = tolower((unsigned char)name[i]);
+  out[len] = 0;
+  return 0;
+}
+
+/****************************************************
+ * load_hosts - Put /etc/hosts into the cache       *
+ *                                                  *
+ * Those names never expire, the same as the system *
+ * resolver checking the file before asking DNS.    *
+ ****************************************************/
+static void load_hosts(struct dns_resolver *r) {
+  FILE *file;
+  char line[1024], name[256];
+  char *tok, *save;
+  union sockaddr_any addr;
+  struct dns_entry *e;
+  int idx;
+
+  if ((file = fopen("/etc/hosts", "r")) == NULL) return;
+  while (fgets(line, sizeof(line), file)) {
+    if ((tok = strchr(line, '#')) != NULL) *tok = 0;
+    if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL) continue;
+    memset(&addr, 0, sizeof(addr));
+    if (inet_pton(AF_INET, tok, &addr.in4.sin_addr) == 1) addr.sa.sa_family = AF_INET;
+    else if (inet_pton(AF_INET6, tok, &addr.in6.sin6_addr) == 1) addr.sa.sa_family = AF_INET6;
+    else continue;
+    if (r->family != AF_UNSPEC && r->family != addr.sa.sa_family) continue;
+
+    while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+      if (lower_name(tok, name, sizeof(name)) < 0) continue;
+      if ((idx = find_entry(r, name)) < 0 && (idx = add_entry(r, name)) < 0) break;
+      e = &r->entries[idx];
+      e->state = DNS_FIXED;
+      if (e->naddrs < DNS_MAX_ADDRS) e->addrs[e->naddrs++] = addr;
+    }
+  }
+  fclose(file);
+}
+
+/*****************************************************
+ * dns_init - Set up the cache and the query socket  *
+ *                                                   *
+ * server picks the name server; NULL uses the first *
+ * one in /etc/resolv.conf.  Without one, every name *
+ * not in /etc/hosts simply fails to resolve.        *
+ * Returns 0 on success, -1 when out of memory.      *
+ *****************************************************/
+int dns_init(struct dns_resolver *r, int family, const union sockaddr_any *server) {
+  int i;
+
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+  r->family = family;
+  r->next_expiry_ns = INT64_MAX;
+  for (i = 0; i < DNS_INFLIGHT; i++) {
+    r->lookups[i].entry = -1;
+    r->free_lookups[i] = DNS_INFLIGHT - 1 - i;
+  }
+  r->nfree = DNS_INFLIGHT;
+  load_hosts(r);
+
+  if (server) r->server = *server;
+  else if (system_server(&r->server) < 0) return 0;
+  r->fd = socket(r->server.sa.sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (r->fd >= 0 && connect(r->fd, &r->server.sa, sockaddr_len(&r->server)) < 0) {
+    close(r->fd);
+    r->fd = -1;
+  }
+  return 0;
+}
+
+/***********************************
+ * dns_free - Release the resolver *
+ ***********************************/
+void dns_free(struct dns_resolver *r) {
+  if (r->fd >= 0) close(r->fd);
+  free(r->entries);
+  free(r->hash);
+  free(r->names);
+  free(r->queue);
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+}
+
+/************************************
+ * dns_name - Name of a cache entry *
+ ************************************/
+const char *dns_name(const struct dns_resolver *r, int entry) {
+  return r->names + r->entries[entry].name;
+}
+
+/*****************************************************
+ * encode_query - Build a recursive query for name   *
+ *                                                   *
+ * Returns the message length, -1 if the name has an *
+ * empty or overlong label.                          *
+ *****************************************************/
+static int encode_query(uint8_t *msg, uint16_t id, const char *name, uint16_t type) {
+  uint8_t *p = msg + 12;
+  const char *label = name, *dot;
+  size_t len;
+
+  memset(msg, 0, 12);
+  msg[0] = id >> 8;
+  msg[1] = id & 0xff;
+  msg[2] = 0x01; // Recursion desired
+  msg[5] = 1;    // One question
+  for (;;) {
+    dot = strchr(label, '.');
+    len = dot ? (size_t)(dot - label) : strlen(label);
+    if (len == 0 || len > 63 || p + len + 6 > msg + DNS_MSG_LEN) return -1;
+    *p++ = len;
+    memcpy(p, label, len);
+    p += len;
+    if (!dot) break;
+    label = dot + 1;
+  }
+  *p++ = 0;
+  *p++ = type >> 8;
+  *p++ = type & 0xff;
+  *p++ = 0;
+  *p++ = DNS_CLASS_IN;
+  return p - msg;
+}
+
+/***************************************************
+ * send_queries - Send the unanswered queries of a *
+ *                lookup                           *
+ ***************************************************/
+static void send_queries(struct dns_resolver *r, int idx, int64_t now) {
+  struct dns_lookup *lk = &r->lookups[idx];
+  uint8_t msg[DNS_MSG_LEN];
+  int len, bit;
+
+  for (bit = 0; bit < 2; bit++) {
+    if (!(lk->waiting & (1 << bit))) continue;
+    len = encode_query(msg, QUERY_ID(lk->salt, idx, bit), dns_name(r, lk->entry), bit ? DNS_TYPE_AAAA : DNS_TYPE_A);
+    if (len < 0 || send(r->fd, msg, len, 0) < 0) lk->waiting &= ~(1 << bit);
+  }
+  lk->tries++;
+  lk->deadline_ns = now + DNS_RETRY_NS;
+}
+
+/****************************************************
+ * start_lookups - Hand queued entries free lookups *
+ ****************************************************/
+static void start_lookups(struct dns_resolver *r, int64_t now) {
+  struct dns_lookup *lk;
+  int idx, entry;
+
+  while (r->nfree && r->queue_head < r->queue_len) {
+    entry = r->queue[r->queue_head++];
+    idx = r->free_lookups[--r->nfree];
+    lk = &r->lookups[idx];
+    memset(lk, 0, sizeof(*lk));
+    lk->entry = entry;
+    lk->ttl = DNS_MAX_TTL;
+    lk->waiting = (r->family != AF_INET6 ? 1 : 0) | (r->family != AF_INET ? 2 : 0);
+    // The salt stays put across tries so a late answer to the first still counts
+    if (getrandom(&lk->salt, sizeof(lk->salt), GRND_NONBLOCK) != sizeof(lk->salt))
+      lk->salt = (uint16_t)now;
+    r->entries[entry].state = DNS_PENDING;
+    send_queries(r, idx, now);
+  }
+  if (r->queue_head == r->queue_len) r->queue_head = r->queue_len = 0;
+}
+
+/*******************************************
+ * enqueue - Line an entry up for a lookup *
+ *******************************************/
+static void enqueue(struct dns_resolver *r, int entry) {
+  if (r->queue_len == r->size) {
+    memmove(r->queue, r->queue + r->queue_head, (r->queue_len - r->queue_head) * sizeof(int));
+    r->queue_len -= r->queue_head;
+    r->queue_head = 0;
+  }
+  r->entries[entry].state = DNS_QUEUED;
+  r->queue[r->queue_len++] = entry;
+}
+
+/****************************************************
+ * dns_resolve - Find or start a lookup for a name  *
+ *                                                  *
+ * Names already cached or in flight share the one  *
+ * entry.  Returns the entry, -1 if the name is not *
+ * valid or memory ran out.                         *
+ ****************************************************/
+int dns_resolve(struct dns_resolver *r, const char *name) {
+  char lower[256];
+  int idx;
+
+  if (lower_name(name, lower, sizeof(lower)) < 0) return -1;
+  if ((idx = find_entry(r, lower)) >= 0) return idx;
+  if ((idx = add_entry(r, lower)) < 0) return -1;
+  if (r->fd < 0) {
+    r->entries[idx].state = DNS_FAILED;
+    return idx;
+  }
+  enqueue(r, idx);
+  start_lookups(r, clock_ns());
+  return idx;
+}
+
+/**************************************************
+ * finish_lookup - Store what a lookup found      *
+ *                                                *
+ * IPv4 addresses go first.  A refresh that finds *
+ * nothing keeps the old answer and tries again a *
+ * little later.                                  *
+ **************************************************/
+static void finish_lookup(struct dns_resolver *r, int idx, int64_t now) {
+  struct dns_lookup *lk = &r->lookups[idx];
+  struct dns_entry *e = &r->entries[lk->entry];
+  int i, n = 0, entry = lk->entry;
+  uint32_t ttl = lk->ttl < DNS_MIN_TTL ? DNS_MIN_TTL : lk->ttl;
+
+  if (lk->naddrs) {
+    for (i = 0; i < lk->naddrs; i++)
+      if (lk->addrs[i].sa.sa_family == AF_INET) e->addrs[n++] = lk->addrs[i];
+    for (i = 0; i < lk->naddrs; i++)
+      if (lk->addrs[i].sa.sa_family == AF_INET6) e->addrs[n++] = lk->addrs[i];
+    e->naddrs = n;
+    e->state = DNS_DONE;
+    e->expires_ns = now + (int64_t)ttl * NSEC_PER_SEC;
+  } else if (e->refreshing) {
+    e->state = DNS_DONE;
+    e->expires_ns = now + DNS_FAIL_NS;
+  } else {
+    e->state = DNS_FAILED;
+  }
+  if (e->expires_ns < r->next_expiry_ns) r->next_expiry_ns = e->expires_ns;
+
+  lk->entry = -1;
+  r->free_lookups[r->nfree++] = idx;
+  start_lookups(r, now);
+  if (e->refreshing && lk->naddrs && r->on_update) r->on_update(r, entry, r->ctx);
+}
+
+/******************************************************
+ * skip_name - Step over a possibly compressed name   *
+ *                                                    *
+ * Returns the offset after it, -1 if it runs off the *
+ * end of the message.                                *
+ ******************************************************/
+static int skip_name(const uint8_t *msg, int len, int off) {
+  while (off < len) {
+    if (msg[off] == 0) return off + 1;
+    if ((msg[off] & 0xc0) == 0xc0) return off + 2 <= len ? off + 2 : -1;
+    off += msg[off] + 1;
+  }
+  return -1;
+}
+
+/****************************************************
+ * parse_answer - Collect the addresses in a reply  *
+ *                                                  *
+ * The reply must echo the question that was asked. *
+ * Any CNAME records in front of the addresses are  *
+ * stepped over.                                    *
+ ****************************************************/
+static void parse_answer(struct dns_resolver *r, const uint8_t *msg, int len, int64_t now) {
+  struct dns_lookup *lk;
+  uint8_t query[DNS_MSG_LEN];
+  uint16_t id, type, rtype, rclass, rdlen, ancount;
+  uint32_t ttl;
+  int idx, bit, qlen, off, i;
+
+  if (len < 12 || !(msg[2] & 0x80)) return;
+  id = (msg[0] << 8) | msg[1];
+  idx = (id >> 1) & (DNS_INFLIGHT - 1);
+  bit = id & 1;
+  lk = &r->lookups[idx];
+  if (lk->entry < 0 || id != QUERY_ID(lk->salt, idx, bit) || !(lk->waiting & (1 << bit))) return;
+
+  type = bit ? DNS_TYPE_AAAA : DNS_TYPE_A;
+  qlen = encode_query(query, id, dns_name(r, lk->entry), type);
+  if (qlen < 0 || len < qlen || msg[4] != 0 || msg[5] != 1) return;
+  for (i = 12; i < qlen; i++)
+    if (tolower(msg[i]) != query[i]) return;
+
+  lk->waiting &= ~(1 << bit);
+  if ((msg[3] & 0x0f) == 0) { // No error
+    ancount = (msg[6] << 8) | msg[7];
+    for (off = qlen; ancount-- && (off = skip_name(msg, len, off)) >= 0 && off + 10 <= len; off += rdlen) {
+      rtype = (msg[off] << 8) | msg[off + 1];
+      rclass = (msg[off + 2] << 8) | msg[off + 3];
+      ttl = ((uint32_t)msg[off + 4] << 24) | (msg[off + 5] << 16) | (msg[off + 6] << 8) | msg[off + 7];
+      rdlen = (msg[off + 8] << 8) | msg[off + 9];
+      off += 10;
+      if (off + rdlen > len) break;
+      if (rtype != type || rclass != DNS_CLASS_IN || lk->naddrs == DNS_MAX_ADDRS) continue;
+      if (ttl < lk->ttl) lk->ttl = ttl;
+      memset(&lk->addrs[lk->naddrs], 0, sizeof(lk->addrs[0]));
+      if (type == DNS_TYPE_A && rdlen == 4) {
+        lk->addrs[lk->naddrs].in4.sin_family = AF_INET;
+        memcpy(&lk->addrs[lk->naddrs++].in4.sin_addr, msg + off, 4);
+      } else if (type == DNS_TYPE_AAAA && rdlen == 16) {
+        lk->addrs[lk->naddrs].in6.sin6_family = AF_INET6;
+        memcpy(&lk->addrs[lk->naddrs++].in6.sin6_addr, msg + off, 16);
+      }
+    }
+  }
+  if (lk->waiting == 0) finish_lookup(r, idx, now);
+}
+
+/***********************************************
+ * dns_read - Handle every reply on the socket *
+ ***********************************************/
+void dns_read(struct dns_resolver *r) {
+  uint8_t msg[DNS_MSG_LEN];
+  int len;
+
+  if (r->fd < 0) return;
+  while ((len = recv(r->fd, msg, sizeof(msg), 0)) > 0)
+    parse_answer(r, msg, len, clock_ns());
+}
+
+/**************************************************
+ * dns_process - Resend lost queries and refresh  *
+ *               expired answers                  *
+ *                                                *
+ * Expired entries are only looked for once the   *
+ * soonest expiry has passed, so this stays cheap *
+ * when called after every wakeup.                *
+ **************************************************/
+void dns_process(struct dns_resolver *r, int64_t now) {
+  struct dns_lookup *lk;
+  struct dns_entry *e;
+  int i;
+
+  if (r->fd < 0) return;
+  for (i = 0; r->nfree < DNS_INFLIGHT && i < DNS_INFLIGHT; i++) {
+    lk = &r->lookups[i];
+    if (lk->entry < 0 || lk->deadline_ns > now) continue;
+    if (lk->tries < DNS_TRIES) send_queries(r, i, now);
+    else lk->waiting = 0;
+    if (lk->waiting == 0) finish_lookup(r, i, now);
+  }
+
+  if (now < r->next_expiry_ns) return;
+  r->next_expiry_ns = INT64_MAX;
+  for (i = 0; i < r->count; i++) {
+    e = &r->entries[i];
+    if (e->state != DNS_DONE) continue;
+    if (e->expires_ns <= now) {
+      e->refreshing = TRUE;
+      enqueue(r, i);
+    } else if (e->expires_ns < r->next_expiry_ns) {
+      r->next_expiry_ns = e->expires_ns;
+    }
+  }
+  start_lookups(r, now);
+}
+
+/*****************************************************
+ * dns_next - When dns_process() next has work to do *
+ *****************************************************/
+int64_t dns_next(const struct dns_resolver *r) {
+  int64_t when = r->next_expiry_ns;
+  int i;
+
+  if (r->fd < 0) return INT64_MAX;
+  for (i = 0; r->nfree < DNS_INFLIGHT && i < DNS_INFLIGHT; i++) {
+    if (r->lookups[i].entry >= 0 && r->lookups[i].deadline_ns < when)
+      when = r->lookups[i].deadline_ns;
+  }
+  return when;
+}
+
+/****************************************************
+ * dns_wait - Block until every lookup has finished *
+ *                                                  *
+ * Used for the first resolution of the targets,    *
+ * before there is anything else to do.             *
+ ****************************************************/
+void dns_wait(struct dns_resolver *r) {
+  struct pollfd pfd;
+  int64_t now, wake;
+
+  if (r->fd < 0) return;
+  pfd.fd = r->fd;
+  pfd.events = POLLIN;
+  while (!terminate && (r->nfree < DNS_INFLIGHT || r->queue_head < r->queue_len)) {
+    now = clock_ns();
+    wake = dns_next(r);
+    if (wake > now + NSEC_PER_SEC) wake = now + NSEC_PER_SEC;
+    poll(&pfd, 1, wake > now ? (int)((wake - now) / NSEC_PER_MSEC) + 1 : 0);
+    dns_read(r);
+    dns_process(r, clock_ns());
+  }
+}
@@ -0,0 +1,100 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef DNS_H
+#define DNS_H
+
+#include <stdint.h>      // int64_t
+#include <stddef.h>      // size_t
+#include "tcpping.h"
+
+#define DNS_MAX_ADDRS 8    // Addresses kept per name
+#define DNS_INFLIGHT  256  // Lookups outstanding at once
+#define DNS_TRIES     3    // Queries sent before a lookup gives up
+
+/*********************
+ * Cache entry state *
+ *********************/
+typedef enum {
+  DNS_QUEUED = 0, // Waiting for a free lookup
+  DNS_PENDING,    // Queries on the wire
+  DNS_DONE,       // Answer cached until expires_ns
+  DNS_FAILED,     // First lookup found nothing
+  DNS_FIXED       // From /etc/hosts, never looked up again
+} dns_state;
+
+/*****************************************************
+ * dns_entry - One cached name                       *
+ *                                                   *
+ * The addresses stay in place while a refresh is in *
+ * flight, so a name never goes blank between TTLs.  *
+ *****************************************************/
+struct dns_entry {
+  uint32_t name;          // Offset of the name in the arena
+  dns_state state;        // See above
+  boolean refreshing;     // Looked up again after expiring
+  int naddrs;             // Addresses held
+  union sockaddr_any addrs[DNS_MAX_ADDRS]; // IPv4 first, port 0
+  int64_t expires_ns;     // When to look the name up again
+  int targets;            // Head of the caller's list of users, -1 if none
+  union sockaddr_any current; // Address the caller's users were last moved to
+};
+
+/******************************************************
+ * dns_lookup - Queries in flight for one entry       *
+ *                                                    *
+ * The A and AAAA queries share the lookup; the query *
+ * id carries the lookup index and the record type.   *
+ ******************************************************/
+struct dns_lookup {
+  int entry;              // Entry being looked up, -1 when free
+  uint16_t salt;          // Random high bits of the query id
+  int waiting;            // Bit per record type still unanswered
+  int tries;              // Times the queries were sent
+  int64_t deadline_ns;    // When to send them again
+  uint32_t ttl;           // Smallest TTL seen
+  int naddrs;             // Addresses collected
+  union sockaddr_any addrs[DNS_MAX_ADDRS];
+};
+
+struct dns_resolver;
+typedef void (*dns_update_fn)(struct dns_resolver *r, int entry, void *ctx);
+
+struct dns_resolver {
+  int fd;                     // UDP socket connected to the server, -1 if none
+  union sockaddr_any server;  // Name server
+  int family;                 // AF_UNSPEC, AF_INET or AF_INET6
+  struct dns_entry *entries;  // Cache
+  int count;                  // Entries in use
+  int size;                   // Entries allocated
+  int *hash;                  // Open addressed index into entries, -1 if empty
+  int hash_size;              // Power of two
+  char *names;                // NUL separated names
+  size_t names_len;           // Bytes of the arena in use
+  size_t names_size;          // Bytes of the arena allocated
+  struct dns_lookup lookups[DNS_INFLIGHT];
+  int free_lookups[DNS_INFLIGHT]; // Stack of free lookup indexes
+  int nfree;                  // Entries on the free stack
+  int *queue;                 // Entries waiting for a lookup (ring)
+  int queue_head;             // Next entry to start
+  int queue_len;              // Entries queued
+  int64_t next_expiry_ns;     // Soonest expires_ns over the cache
+  dns_update_fn on_update;    // Called when a refresh finishes
+  void *ctx;                  // Callback context
+};
+
+int dns_parse_server(const char *str, union sockaddr_any *addr);
+int dns_init(struct dns_resolver *r, int family, const union sockaddr_any *server);
+int dns_resolve(struct dns_resolver *r, const char *name);
+void dns_wait(struct dns_resolver *r);
+void dns_read(struct dns_resolver *r);
+void dns_process(struct dns_resolver *r, int64_t now);
+int64_t dns_next(const struct dns_resolver *r);
+const char *dns_name(const struct dns_resolver *r, int entry);
+void dns_free(struct dns_resolver *r);
+
+#endif
@@ -0,0 +1,736 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdlib.h>     // malloc
+#include <unistd.h>     // close
+#include <string.h>     // memset
+#include <errno.h>      // errno
+#include <sys/socket.h> // socket, connect
+#include <sys/timerfd.h> // timerfd
+#include <poll.h>       // poll
+#include <netinet/tcp.h> // TCP_INFO
+#include "engine.h"
+
+#define TIMER_EVENT UINT64_MAX       // epoll data marking the wakeup timer
+#define RAW_EVENT (UINT64_MAX - 1)   // epoll data marking the SYN raw socket
+#define WATCH_EVENT (UINT64_MAX - 2) // epoll data marking watched descriptor 0, counting down
+#define SYN_ID_BITS 24               // Slot index bits in a SYN probe id
+#define SYN_WAITS 3                  // 1 ms waits for a full send queue before a SYN fails
+
+/*****************************************************
+ * engine_init - Allocate the slot table and epoll   *
+ *                                                   *
+ * Everything the engine needs is allocated here so  *
+ * sending and reaping probes never touches the heap *
+ * Returns 0 on success, -1 on failure.              *
+ *****************************************************/
+int engine_init(struct engine *eng, int nslots, int64_t timeout_ns, result_fn on_result, void *ctx) {
+  struct epoll_event ev;
+  int i;
+
+  memset(eng, 0, sizeof(*eng));
+  eng->tfd = -1;
+  eng->raw.fd = -1;
+  eng->raw.fd6 = -1;
+  eng->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (eng->epfd < 0) return -1;
+
+  // The wakeup timer is edge triggered and simply re-armed, never read
+  eng->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = TIMER_EVENT;
+  if (eng->tfd < 0 || epoll_ctl(eng->epfd, EPOLL_CTL_ADD, eng->tfd, &ev) < 0) {
+    engine_free(eng);
+    return -1;
+  }
+
+  eng->slots = calloc(nslots, sizeof(struct probe_slot));
+  eng->free_slots = calloc(nslots, sizeof(int));
+  eng->events = calloc(nslots, sizeof(struct epoll_event));
+  if (!eng->slots || !eng->free_slots || !eng->events || wheel_init(&eng->deadlines, nslots, clock_ns()) < 0) {
+    engine_free(eng);
+    return -1;
+  }
+
+  // Push the slots in reverse so slot 0 is handed out first
+  for (i = 0; i < nslots; i++) {
+    eng->slots[i].fd = -1;
+    eng->free_slots[i] = nslots - 1 - i;
+  }
+  eng->nfree = nslots;
+  eng->nslots = nslots;
+  eng->timeout_ns = timeout_ns;
+  eng->on_result = on_result;
+  eng->ctx = ctx;
+  return 0;
+}
+
+/*******************************************
+ * engine_free - Release the engine        *
+ *                                         *
+ * Closes any probes still in flight along *
+ * with the epoll descriptor.              *
+ *******************************************/
+void engine_free(struct engine *eng) {
+  int i;
+  if (eng->slots) {
+    for (i = 0; i < eng->nslots; i++)
+      if (eng->slots[i].fd >= 0) close(eng->slots[i].fd);
+  }
+  if (eng->syn) syn_close(&eng->raw);
+  if (eng->tfd >= 0) close(eng->tfd);
+  if (eng->epfd >= 0) close(eng->epfd);
+  free(eng->slots);
+  free(eng->free_slots);
+  free(eng->events);
+  wheel_free(&eng->deadlines);
+  eng->slots = NULL;
+  eng->free_slots = NULL;
+  eng->events = NULL;
+  eng->epfd = -1;
+  eng->tfd = -1;
+}
+
+/******************************************************
+ * kernel_rtt - RTT the kernel measured for the       *
+ *              handshake                             *
+ *                                                    *
+ * Right after connecting, the only sample behind     *
+ * tcpi_rtt is the SYN to SYN-ACK time, taken by the  *
+ * kernel with microsecond resolution and without any *
+ * of our wakeup latency.                             *
+ * Returns the time in ns, -1 if it is not available. *
+ ******************************************************/
+static int64_t kernel_rtt(int fd) {
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0 || info.tcpi_rtt == 0)
+    return -1;
+  return (int64_t)info.tcpi_rtt * 1000;
+}
+
+/******************************************************
+ * probe_classify - Sort a probe's outcome by cause   *
+ *                                                    *
+ * A refused connection is a live host answering with *
+ * a RST, an unreachable one an ICMP error from a     *
+ * router, and a local failure never left this host.  *
+ ******************************************************/
+probe_reason probe_classify(probe_outcome outcome, int error) {
+  if (outcome == PROBE_OK) return REASON_OK;
+  if (outcome == PROBE_TIMEOUT) return REASON_TIMEOUT;
+  switch (error) {
+  case ECONNREFUSED: case ECONNRESET: return REASON_REFUSED;
+  case EHOSTUNREACH: case ENETUNREACH: case EHOSTDOWN: case ENETDOWN: return REASON_UNREACHABLE;
+  case ETIMEDOUT: return REASON_TIMEOUT;
+  case EADDRNOTAVAIL: case EADDRINUSE: case EMFILE: case ENFILE: case ENOBUFS: case ENOMEM:
+  case EAFNOSUPPORT: case EPERM: case EACCES: return REASON_LOCAL;
+  default: return REASON_OTHER;
+  }
+}
+
+/***************************************
+ * probe_reason_name - Short name of a *
+ *                     reason          *
+ ***************************************/
+const char *probe_reason_name(probe_reason reason) {
+  static const char *names[PROBE_REASONS] = { "ok", "timeout", "other", "refused", "unreachable", "local" };
+  return reason < PROBE_REASONS ? names[reason] : "other";
+}
+
+/*******************************************************
+ * engine_hang_up - Close the socket of a completed    *
+ *                  handshake                          *
+ *                                                     *
+ * A plain close() sends a FIN and leaves the socket   *
+ * in TIME_WAIT on this host for a minute, holding its *
+ * local port.  With a zero linger time the kernel     *
+ * sends a RST and forgets the connection at once; in  *
+ * repair mode it forgets it without sending anything, *
+ * leaving the server to time out its side.            *
+ *******************************************************/
+void engine_hang_up(int fd, close_mode closing) {
+  static const struct linger reset = { 1, 0 };
+  int on = 1;
+
+  if (closing == CLOSE_ABORT && setsockopt(fd, IPPROTO_TCP, TCP_REPAIR, &on, sizeof(on)) == 0) {
+    close(fd);
+    return;
+  }
+  if (closing != CLOSE_FIN) setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+  close(fd);
+}
+
+/****************************************************
+ * engine_can_abort - Whether repair mode is        *
+ *                    allowed                       *
+ *                                                  *
+ * TCP_REPAIR needs CAP_NET_ADMIN; without it       *
+ * CLOSE_ABORT quietly falls back to a RST on every *
+ * probe, so callers may want to say so up front.   *
+ ****************************************************/
+boolean engine_can_abort(void) {
+  int fd, on = 1;
+  boolean ok;
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return FALSE;
+  ok = setsockopt(fd, IPPROTO_TCP, TCP_REPAIR, &on, sizeof(on)) == 0;
+  close(fd);
+  return ok;
+}
+
+/*********************************************
+ * finish - Report a probe and free its slot *
+ *********************************************/
+static void finish(struct engine *eng, int idx, probe_outcome outcome, int error, int64_t now) {
+  struct probe_slot *slot = &eng->slots[idx];
+  struct probe_result res;
+  struct timespec wall;
+
+  res.target = slot->target;
+  res.seq = slot->seq;
+  res.outcome = outcome;
+  res.error = error;
+  res.reason = probe_classify(outcome, error);
+  res.sent_ns = slot->sent_ns;
+  res.rtt_ns = now - slot->sent_ns;
+  res.kernel_rtt_ns = -1;
+  res.reply_ns = -1;
+  res.timeout_ns = slot->timeout_ns;
+  res.addr = slot->dest;
+  // After a hello the socket's rtt also has the data exchange in it, so take the one read at the SYN-ACK
+  if (outcome == PROBE_OK && eng->kernel_rtt)
+    res.kernel_rtt_ns = slot->connected_ns ? slot->kernel_rtt_ns : kernel_rtt(slot->fd);
+  // A probe that got its reply reports the connect and the reply separately
+  if (outcome == PROBE_OK && slot->connected_ns) {
+    res.rtt_ns = slot->connected_ns - slot->sent_ns;
+    res.reply_ns = now - slot->connected_ns;
+  }
+  // From the SYN to the stamp the path was crossed twice each way, the last time back after the stamp
+  res.forward_ns = res.reverse_ns = -1;
+  if (res.reply_ns >= 0 && eng->hello == HELLO_STAMP) {
+    clock_gettime(CLOCK_REALTIME, &wall);
+    res.reverse_ns = (int64_t)wall.tv_sec * NSEC_PER_SEC + wall.tv_nsec - stamp_get(slot->reply);
+    res.forward_ns = (now - slot->sent_ns) / 2 - res.reverse_ns;
+  }
+
+  // Closing the socket also removes it from the epoll set
+  wheel_clear(&eng->deadlines, idx);
+  if (slot->fd >= 0 && outcome == PROBE_OK) engine_hang_up(slot->fd, eng->closing);
+  else if (slot->fd >= 0) close(slot->fd);
+  slot->fd = -1;
+  slot->busy = FALSE;
+  slot->gen++;
+  eng->free_slots[eng->nfree++] = idx;
+  eng->inflight--;
+
+  eng->on_result(eng, &res, eng->ctx);
+}
+
+/*************************************************
+ * report_now - Report a probe that never got a  *
+ *              slot (socket or connect failure) *
+ *************************************************/
+static void report_now(struct engine *eng, const union sockaddr_any *addr, int target, int seq, int64_t sent, int error) {
+  struct probe_result res;
+
+  res.target = target;
+  res.seq = seq;
+  res.outcome = PROBE_ERROR;
+  res.error = error;
+  res.reason = probe_classify(PROBE_ERROR, error);
+  res.sent_ns = sent;
+  res.rtt_ns = clock_ns() - sent;
+  res.kernel_rtt_ns = -1;
+  res.reply_ns = -1;
+  res.forward_ns = res.reverse_ns = -1;
+  res.timeout_ns = 0;
+  res.addr = *addr;
+  eng->on_result(eng, &res, eng->ctx);
+}
+
+/******************************************************
+ * engine_syn - Switch the engine to half-open SYN    *
+ *              probing                               *
+ *                                                    *
+ * Probes become single hand-built SYNs sent on one   *
+ * raw socket in sendmmsg() batches, with no          *
+ * per-probe socket at all.  The                      *
+ * slot index and generation are encoded in the SYN's *
+ * sequence number, so a reply is matched back to its *
+ * probe from the acknowledgement number alone.       *
+ * Returns 0 on success, -1 with errno set otherwise. *
+ ******************************************************/
+int engine_syn(struct engine *eng, int nports) {
+  struct epoll_event ev;
+
+  if (eng->nslots > (1 << SYN_ID_BITS)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (syn_open(&eng->raw, nports) < 0) return -1;
+  // Without the packet ring, replies are read off the raw socket itself
+  syn_ring_open(&eng->raw);
+  ev.events = EPOLLIN;
+  ev.data.u64 = RAW_EVENT;
+  if (epoll_ctl(eng->epfd, EPOLL_CTL_ADD, eng->raw.ring_fd >= 0 ? eng->raw.ring_fd : eng->raw.fd, &ev) < 0 ||
+      (eng->raw.ring_fd < 0 && eng->raw.fd6 >= 0 && epoll_ctl(eng->epfd, EPOLL_CTL_ADD, eng->raw.fd6, &ev) < 0)) {
+    syn_close(&eng->raw);
+    return -1;
+  }
+  eng->syn = TRUE;
+  return 0;
+}
+
+/*****************************************************
+ * engine_watch - Call fn whenever fd turns readable *
+ *                                                   *
+ * Lets another event source, such as the resolver,  *
+ * share the engine's wait.  Up to ENGINE_WATCHES    *
+ * are supported.                                    *
+ * Returns 0 on success, -1 with errno set.          *
+ *****************************************************/
+int engine_watch(struct engine *eng, int fd, watch_fn fn, void *ctx) {
+  struct epoll_event ev;
+
+  if (eng->nwatch == ENGINE_WATCHES) {
+    errno = ENOSPC;
+    return -1;
+  }
+  ev.events = EPOLLIN;
+  ev.data.u64 = WATCH_EVENT - eng->nwatch;
+  if (epoll_ctl(eng->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) return -1;
+  eng->on_watch[eng->nwatch] = fn;
+  eng->watch_ctx[eng->nwatch] = ctx;
+  eng->nwatch++;
+  return 0;
+}
+
+static void flush_syns(struct engine *eng);
+
+/******************************************************
+ * probe_syn - Queue a half-open SYN probe            *
+ *                                                    *
+ * A batch only holds one address family, so a change *
+ * of family sends what is queued first.              *
+ ******************************************************/
+static int probe_syn(struct engine *eng, const union sockaddr_any *addr, const union sockaddr_any *source, int target, int seq, int64_t timeout_ns) {
+  struct probe_slot *slot;
+  uint32_t id;
+  uint16_t sport;
+  int idx, n;
+
+  if (addr->sa.sa_family == AF_INET6 && eng->raw.fd6 < 0) {
+    report_now(eng, addr, target, seq, clock_ns(), EAFNOSUPPORT);
+    return 0;
+  }
+  idx = eng->free_slots[--eng->nfree];
+  slot = &eng->slots[idx];
+  slot->busy = TRUE;
+  slot->fd = -1;
+  slot->connected_ns = 0;
+  slot->dest = *addr;
+  slot->target = target;
+  slot->seq = seq;
+  slot->timeout_ns = timeout_ns;
+  eng->inflight++;
+
+  id = ((slot->gen & 0xff) << SYN_ID_BITS) | idx;
+  sport = eng->raw.port_base + idx % eng->raw.nports;
+  n = syn_queue(&eng->raw, addr, source, sport, id ^ eng->raw.secret);
+  if (n < 0) {
+    flush_syns(eng);
+    n = syn_queue(&eng->raw, addr, source, sport, id ^ eng->raw.secret);
+  }
+  eng->batch_slots[n] = idx;
+  if (eng->raw.queued == SYN_BATCH) flush_syns(eng);
+  return 0;
+}
+
+/*****************************************************
+ * stamp_syns - Time queued SYNs from first on       *
+ *                                                   *
+ * They get one clock read just before sendmmsg()    *
+ * and their deadlines are moved to match.           *
+ *****************************************************/
+static void stamp_syns(struct engine *eng, int first, int queued) {
+  struct probe_slot *slot;
+  int64_t now = clock_ns();
+  int i;
+
+  for (i = first; i < queued; i++) {
+    slot = &eng->slots[eng->batch_slots[i]];
+    slot->sent_ns = now;
+    slot->deadline_ns = now + slot->timeout_ns;
+    wheel_set(&eng->deadlines, eng->batch_slots[i], slot->deadline_ns);
+  }
+}
+
+/*****************************************************
+ * flush_syns - Send the queued SYN batch            *
+ *                                                   *
+ * A partial send is picked up where it stopped.  A  *
+ * full send queue gets a few short waits, with the  *
+ * rest restamped after each, before the frame at    *
+ * its head fails.  Any other error fails just that  *
+ * frame and the rest are sent.                      *
+ *****************************************************/
+static void flush_syns(struct engine *eng) {
+  struct pollfd pfd;
+  int start = 0, sent, waits = 0, queued = eng->raw.queued;
+
+  if (queued == 0) return;
+  stamp_syns(eng, 0, queued);
+  pfd.fd = eng->raw.family == AF_INET6 ? eng->raw.fd6 : eng->raw.fd;
+  pfd.events = POLLOUT;
+  while (start < queued) {
+    sent = syn_flush(&eng->raw, start);
+    if (sent > 0) {
+      start += sent;
+      waits = 0;
+    } else if (sent < 0 && errno == EINTR) {
+      continue;
+    } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) && waits < SYN_WAITS) {
+      waits++;
+      poll(&pfd, 1, 1);
+      stamp_syns(eng, start, queued);
+    } else {
+      finish(eng, eng->batch_slots[start], PROBE_ERROR, sent < 0 ? errno : EIO, clock_ns());
+      start++;
+      waits = 0;
+    }
+  }
+  eng->raw.queued = 0;
+}
+
+/*****************************************************
+ * match_reply - Match a SYN-ACK or RST to its probe *
+ *                                                   *
+ * A reply must carry the id of a busy slot and come *
+ * from the address and port that slot probed, on    *
+ * the source port it used.                          *
+ *****************************************************/
+static void match_reply(struct engine *eng, const struct syn_reply *reply, int64_t now) {
+  struct probe_slot *slot;
+  uint32_t id;
+  int idx;
+
+  id = (reply->ack - 1) ^ eng->raw.secret;
+  idx = id & ((1 << SYN_ID_BITS) - 1);
+  if (idx >= eng->nslots) return;
+  slot = &eng->slots[idx];
+  if (!slot->busy || (slot->gen & 0xff) != id >> SYN_ID_BITS) return;
+  if (slot->dest.sa.sa_family != reply->from.sa.sa_family || sockaddr_port(&slot->dest) != sockaddr_port(&reply->from)) return;
+  if (slot->dest.sa.sa_family == AF_INET6
+      ? memcmp(&slot->dest.in6.sin6_addr, &reply->from.in6.sin6_addr, 16) != 0
+      : slot->dest.in4.sin_addr.s_addr != reply->from.in4.sin_addr.s_addr) return;
+  if (reply->to_port != eng->raw.port_base + idx % eng->raw.nports) return;
+
+  if (reply->flags & SYN_FLAG_RST) finish(eng, idx, PROBE_ERROR, ECONNREFUSED, now);
+  else finish(eng, idx, PROBE_OK, 0, now);
+}
+
+/***************************************************
+ * ring_packet - syn_ring_read() callback          *
+ *                                                 *
+ * Moves the kernel's CLOCK_REALTIME receive stamp *
+ * onto our clock, so the rtt does not include the *
+ * time the packet waited in the ring.             *
+ ***************************************************/
+static void ring_packet(void *ctx, const uint8_t *pkt, int len, int64_t realtime_ns) {
+  struct engine *eng = ctx;
+  struct syn_reply reply;
+
+  if (syn_parse(&eng->raw, pkt, len, &reply))
+    match_reply(eng, &reply, realtime_ns + eng->ring_offset_ns);
+}
+
+/*****************************************************
+ * read_replies - Drain SYN replies from the ring or *
+ *                the raw sockets                    *
+ *                                                   *
+ * An IPv6 raw socket hands over the TCP header      *
+ * without the IP header in front of it, so the      *
+ * sender comes from recvfrom() instead.             *
+ *****************************************************/
+static void read_replies(struct engine *eng) {
+  struct timespec real;
+  struct syn_reply reply;
+  union sockaddr_any from;
+  socklen_t fromlen;
+  uint8_t pkt[2048];
+  int len;
+
+  if (eng->raw.ring_fd >= 0) {
+    clock_gettime(CLOCK_REALTIME, &real);
+    eng->ring_offset_ns = clock_ns() - ((int64_t)real.tv_sec * NSEC_PER_SEC + real.tv_nsec);
+    syn_ring_read(&eng->raw, ring_packet, eng);
+    return;
+  }
+  while ((len = recv(eng->raw.fd, pkt, sizeof(pkt), 0)) > 0) {
+    if (syn_parse(&eng->raw, pkt, len, &reply)) match_reply(eng, &reply, clock_ns());
+  }
+  if (eng->raw.fd6 < 0) return;
+  fromlen = sizeof(from);
+  while ((len = recvfrom(eng->raw.fd6, pkt, sizeof(pkt), 0, &from.sa, &fromlen)) > 0) {
+    if (syn_parse_tcp(&eng->raw, pkt, len, &reply)) {
+      reply.from.in6.sin6_family = AF_INET6;
+      reply.from.in6.sin6_addr = from.in6.sin6_addr;
+      match_reply(eng, &reply, clock_ns());
+    }
+    fromlen = sizeof(from);
+  }
+}
+
+/*******************************************************
+ * engine_probe - Start a non-blocking tcp ping        *
+ *                                                     *
+ * Opens a socket, fires off connect() and parks the   *
+ * socket in the epoll set until it becomes writable.  *
+ * The probe's state goes into a preallocated slot, so *
+ * the only syscalls are socket(), connect() and       *
+ * epoll_ctl().  Failures before the SYN is sent and   *
+ * handshakes that finish immediately are reported     *
+ * right away.                                         *
+ * Returns 0 when the probe was started or reported,   *
+ * -1 when every slot is busy.                         *
+ *******************************************************/
+int engine_probe(struct engine *eng, const union sockaddr_any *addr, const union sockaddr_any *source, int target, int seq, int64_t timeout_ns) {
+  struct probe_slot *slot;
+  struct epoll_event ev;
+  int64_t sent;
+  int idx, sock, status, error;
+
+  if (eng->nfree == 0) return -1;
+  if (eng->syn) return probe_syn(eng, addr, source, target, seq, timeout_ns);
+
+  // Non-blocking socket create and verification
+  sock = socket(addr->sa.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    report_now(eng, addr, target, seq, clock_ns(), errno);
+    return 0;
+  }
+
+  idx = eng->free_slots[--eng->nfree];
+  slot = &eng->slots[idx];
+  slot->busy = TRUE;
+  slot->fd = sock;
+  slot->connected_ns = 0;
+  slot->got = 0;
+  slot->dest = *addr;
+  slot->target = target;
+  slot->seq = seq;
+  slot->timeout_ns = timeout_ns;
+  eng->inflight++;
+
+  // Read clock before sending/connecting
+  sent = clock_ns();
+  slot->sent_ns = sent;
+  slot->deadline_ns = sent + timeout_ns;
+  wheel_set(&eng->deadlines, idx, slot->deadline_ns);
+
+  // Connect the client socket to server socket
+  status = connect(sock, &addr->sa, sockaddr_len(addr));
+
+  // Should be a negative status unless the tcp handshake is really fast. :)
+  // With a hello to send, a fast handshake is picked up by the first epoll_wait().
+  if (status == 0 && eng->hello == HELLO_NONE) {
+    finish(eng, idx, PROBE_OK, 0, clock_ns());
+    return 0;
+  }
+  if (status < 0 && errno != EINPROGRESS) {
+    error = errno;
+    finish(eng, idx, PROBE_ERROR, error, clock_ns());
+    return 0;
+  }
+
+  ev.events = EPOLLOUT;
+  ev.data.u64 = ((uint64_t)slot->gen << 32) | (uint32_t)idx;
+  if (epoll_ctl(eng->epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+    error = errno;
+    finish(eng, idx, PROBE_ERROR, error, clock_ns());
+  }
+  return 0;
+}
+
+/*****************************************************
+ * connected - Finish a probe whose handshake is     *
+ *             done, or send its hello               *
+ *                                                   *
+ * The hello is small enough to go out in one send() *
+ * on a fresh socket; the socket then waits in the   *
+ * epoll set for the reply instead.  The kernel's    *
+ * rtt is read first, while the handshake is still   *
+ * its only sample.                                  *
+ *****************************************************/
+static void connected(struct engine *eng, int idx, int64_t now) {
+  struct probe_slot *slot = &eng->slots[idx];
+  const struct iovec *hello;
+  struct epoll_event ev;
+  ssize_t n;
+
+  if (eng->hello == HELLO_NONE) {
+    finish(eng, idx, PROBE_OK, 0, now);
+    return;
+  }
+  hello = &eng->hellos[slot->target];
+  slot->connected_ns = now;
+  if (eng->kernel_rtt) slot->kernel_rtt_ns = kernel_rtt(slot->fd);
+  n = hello->iov_len ? send(slot->fd, hello->iov_base, hello->iov_len, MSG_NOSIGNAL) : 0;
+  if (n != (ssize_t)hello->iov_len) {
+    finish(eng, idx, PROBE_ERROR, n < 0 ? errno : EMSGSIZE, clock_ns());
+    return;
+  }
+  ev.events = EPOLLIN;
+  ev.data.u64 = ((uint64_t)slot->gen << 32) | (uint32_t)idx;
+  if (epoll_ctl(eng->epfd, EPOLL_CTL_MOD, slot->fd, &ev) < 0)
+    finish(eng, idx, PROBE_ERROR, errno, clock_ns());
+}
+
+/*****************************************************
+ * read_reply - Read the start of a hello's answer   *
+ *                                                   *
+ * Only the few bytes needed to recognize the answer *
+ * are read.  The server closing the connection      *
+ * first counts as ECONNABORTED.                     *
+ *****************************************************/
+static void read_reply(struct engine *eng, int idx, int64_t now) {
+  struct probe_slot *slot = &eng->slots[idx];
+  ssize_t n;
+  int answered;
+
+  n = recv(slot->fd, slot->reply + slot->got, HELLO_REPLY - slot->got, 0);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+  if (n <= 0) {
+    finish(eng, idx, PROBE_ERROR, n == 0 ? ECONNABORTED : errno, now);
+    return;
+  }
+  slot->got += n;
+  answered = hello_reply(eng->hello, slot->reply, slot->got);
+  if (answered > 0) finish(eng, idx, PROBE_OK, 0, now);
+  else if (answered < 0) finish(eng, idx, PROBE_ERROR, EPROTO, now);
+}
+
+/***************************************************
+ * expire - Time out every probe past its deadline *
+ ***************************************************/
+static void expire(struct engine *eng, int64_t now) {
+  int idx;
+  while ((idx = wheel_pop(&eng->deadlines, now)) >= 0)
+    finish(eng, idx, PROBE_TIMEOUT, 0, now);
+}
+
+/***************************************************
+ * earliest_deadline - Soonest in-flight timeout   *
+ *                                                 *
+ * Returns until_ns when nothing is due before it. *
+ ***************************************************/
+static int64_t earliest_deadline(struct engine *eng, int64_t until_ns) {
+  int64_t when = wheel_next(&eng->deadlines);
+  return when < until_ns ? when : until_ns;
+}
+
+/*****************************************************
+ * arm_timer - Point the wakeup timer at a raw clock *
+ *             deadline                              *
+ *                                                   *
+ * timerfd cannot use CLOCK_MONOTONIC_RAW, so the    *
+ * deadline is moved onto CLOCK_MONOTONIC by reading *
+ * both clocks back to back.  The two only drift by  *
+ * NTP slew, which is parts per million of the wait. *
+ *****************************************************/
+static void arm_timer(struct engine *eng, int64_t wake_ns) {
+  struct itimerspec its;
+  struct timespec mono;
+  int64_t raw, when;
+
+  if (eng->armed_ns == wake_ns) return;
+  raw = clock_ns();
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  when = (int64_t)mono.tv_sec * NSEC_PER_SEC + mono.tv_nsec + (wake_ns - raw);
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = when / NSEC_PER_SEC;
+  its.it_value.tv_nsec = when % NSEC_PER_SEC;
+  timerfd_settime(eng->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+  eng->armed_ns = wake_ns;
+}
+
+/*******************************************************
+ * engine_poll - Wait for handshakes and timeouts      *
+ *                                                     *
+ * Blocks until until_ns, the next probe deadline or a *
+ * signal, whichever comes first, and reports every    *
+ * probe that finished in the meantime.  Deadlines are *
+ * absolute and kept by a timerfd, so waits are exact  *
+ * to well under a millisecond.  With spin set the     *
+ * wait polls instead and never sleeps, so no wakeup   *
+ * from an idle CPU ends up in an rtt.                 *
+ *******************************************************/
+void engine_poll(struct engine *eng, int64_t until_ns) {
+  struct probe_slot *slot;
+  int64_t now, wake;
+  int n, i, idx, optval, inflight, wait = -1;
+  uint32_t gen;
+  socklen_t optlen;
+
+  if (eng->syn) flush_syns(eng);
+  now = clock_ns();
+  wake = earliest_deadline(eng, until_ns);
+  if (eng->spin) {
+    // SYN replies can sit in the packet ring with no event until its block is handed over
+    inflight = eng->inflight;
+    while ((n = epoll_wait(eng->epfd, eng->events, eng->nslots, 0)) == 0 && !terminate &&
+           eng->inflight == inflight && clock_ns() < wake)
+      if (eng->syn && eng->raw.ring_fd >= 0) read_replies(eng);
+  } else {
+    if (wake <= now) wait = 0;
+    else if (wake != INT64_MAX) arm_timer(eng, wake);
+    n = epoll_wait(eng->epfd, eng->events, eng->nslots, wait);
+  }
+  for (i = 0; i < n; i++) {
+    now = clock_ns(); // Read clock after sending/connecting (after SYN and ACK)
+    if (eng->events[i].data.u64 == TIMER_EVENT) {
+      eng->armed_ns = 0;
+      continue;
+    }
+    if (eng->events[i].data.u64 == RAW_EVENT) {
+      read_replies(eng);
+      continue;
+    }
+    if (eng->events[i].data.u64 > WATCH_EVENT - ENGINE_WATCHES) {
+      idx = WATCH_EVENT - eng->events[i].data.u64;
+      eng->on_watch[idx](eng->watch_ctx[idx]);
+      continue;
+    }
+    idx = (int)(uint32_t)eng->events[i].data.u64;
+    gen = (uint32_t)(eng->events[i].data.u64 >> 32);
+    slot = &eng->slots[idx];
+    if (!slot->busy || slot->gen != gen) continue;
+
+    if (slot->connected_ns) {
+      read_reply(eng, idx, now);
+      continue;
+    }
+    // A handshake that went through only signals writable, no need to ask
+    if (eng->events[i].events == EPOLLOUT) {
+      connected(eng, idx, now);
+      continue;
+    }
+    optval = 0;
+    optlen = sizeof(int);
+    getsockopt(slot->fd, SOL_SOCKET, SO_ERROR, (void*)(&optval), &optlen);
+    if (optval == 0) connected(eng, idx, now);
+    else finish(eng, idx, PROBE_ERROR, optval, now);
+  }
+
+  // A reply may be sitting in a ring block that has not been handed over yet
+  if (eng->syn && eng->raw.ring_fd >= 0) read_replies(eng);
+  expire(eng, clock_ns());
+}
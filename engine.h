@@ -0,0 +1,126 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>      // int64_t
+#include <netinet/in.h>  // sockaddr_in
+#include <sys/epoll.h>   // epoll_event
+#include "tcpping.h"
+#include "syn.h"
+#include "wheel.h"
+#include "hello.h"
+
+/************************************
+ * Probe outcomes and result record *
+ ************************************/
+typedef enum {
+  PROBE_OK = 0,   // Handshake completed
+  PROBE_TIMEOUT,  // No answer before the deadline
+  PROBE_ERROR     // Failure creating or connecting the socket
+} probe_outcome;
+
+struct probe_result {
+  int target;            // Index of the probed target
+  int seq;               // Sequence number of the probe
+  probe_outcome outcome; // What happened
+  int error;             // errno or SO_ERROR value (0 on success)
+  probe_reason reason;   // Outcome broken down by cause
+  int64_t sent_ns;       // Clock when the SYN went out
+  int64_t rtt_ns;        // Round trip time in nanoseconds
+  int64_t kernel_rtt_ns; // Kernel's own SYN to SYN-ACK time, -1 if unknown
+  int64_t reply_ns;      // Connect to ServerHello or first byte, -1 if not asked for
+  int64_t forward_ns;    // One-way delay to the server by its timestamp (HELLO_STAMP)
+  int64_t reverse_ns;    // One-way delay back from the server (HELLO_STAMP)
+  int64_t timeout_ns;    // Timeout the probe was given
+  union sockaddr_any addr; // Where the probe went
+};
+
+/************************************************
+ * How a connect() probe's socket is closed     *
+ * after a completed handshake                  *
+ ************************************************/
+typedef enum {
+  CLOSE_FIN = 0,  // Graceful close, leaves a TIME_WAIT entry behind
+  CLOSE_RST,      // SO_LINGER of 0, the server gets a RST
+  CLOSE_ABORT     // TCP_REPAIR, forgotten without a packet, else CLOSE_RST
+} close_mode;
+
+#define ENGINE_WATCHES 4 // Extra descriptors the engine can wait on
+
+struct engine;
+typedef void (*result_fn)(struct engine *eng, const struct probe_result *res, void *ctx);
+typedef void (*watch_fn)(void *ctx);
+
+/**********************************************
+ * probe_slot - One in-flight probe           *
+ *                                            *
+ * Slots live in a table allocated up front;  *
+ * free ones are kept on a stack of indexes.  *
+ * The generation counter is bumped on reuse  *
+ * so a stale epoll event or a late SYN reply *
+ * can be recognized.  A probe with a hello   *
+ * goes on from the connect to waiting for    *
+ * the reply on the same socket.              *
+ **********************************************/
+struct probe_slot {
+  boolean busy;        // Probe in flight
+  int fd;              // connect() socket, -1 in SYN mode
+  uint32_t gen;        // Reuse generation
+  union sockaddr_any dest; // Where the probe went
+  int target;          // Target index
+  int seq;             // Sequence number
+  int64_t sent_ns;     // Clock before connect()
+  int64_t timeout_ns;  // How long the probe may take
+  int64_t deadline_ns; // Clock when the probe times out, kept in the wheel
+  int64_t connected_ns; // Clock at the SYN-ACK, 0 while connecting
+  int64_t kernel_rtt_ns; // Kernel's handshake rtt, read at the SYN-ACK when a hello follows
+  int got;             // Reply bytes read
+  uint8_t reply[HELLO_REPLY]; // Start of the reply
+};
+
+struct engine {
+  int epfd;                   // epoll instance
+  int tfd;                    // timerfd used for sub-millisecond wakeups
+  int64_t armed_ns;           // Raw clock time the timerfd is set for, 0 if idle
+  struct probe_slot *slots;   // Slot table
+  int *free_slots;            // Stack of free slot indexes
+  int nfree;                  // Entries on the free stack
+  int nslots;                 // Size of the slot table
+  int inflight;               // Probes currently waiting
+  struct wheel deadlines;     // Timeout of every probe on the wire, by slot
+  struct epoll_event *events; // epoll_wait() buffer
+  int64_t timeout_ns;         // Longest per-probe timeout
+  boolean kernel_rtt;         // Read TCP_INFO after each handshake
+  close_mode closing;         // How connected sockets are closed
+  hello_mode hello;           // What to send after connecting
+  const struct iovec *hellos; // Bytes to send, by target, with a hello mode
+  boolean syn;                // Half-open SYN probing on a raw socket
+  boolean spin;               // Busy-poll instead of sleeping in epoll_wait()
+  struct syn_socket raw;      // Raw socket state for SYN mode
+  int batch_slots[SYN_BATCH]; // Slot behind each queued SYN
+  int64_t ring_offset_ns;     // Raw clock minus CLOCK_REALTIME
+  result_fn on_result;        // Completion callback
+  void *ctx;                  // Callback context
+  watch_fn on_watch[ENGINE_WATCHES]; // Handlers for extra readable descriptors
+  void *watch_ctx[ENGINE_WATCHES];   // Their contexts
+  int nwatch;                 // Handlers in use
+};
+
+int engine_init(struct engine *eng, int nslots, int64_t timeout_ns, result_fn on_result, void *ctx);
+int engine_syn(struct engine *eng, int nports);
+int engine_watch(struct engine *eng, int fd, watch_fn fn, void *ctx);
+probe_reason probe_classify(probe_outcome outcome, int error);
+const char *probe_reason_name(probe_reason reason);
+void engine_hang_up(int fd, close_mode closing);
+boolean engine_can_abort(void);
+int engine_probe(struct engine *eng, const union sockaddr_any *addr, const union sockaddr_any *source, int target, int seq, int64_t timeout_ns);
+void engine_poll(struct engine *eng, int64_t until_ns);
+void engine_free(struct engine *eng);
+
+#endif
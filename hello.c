@@ -0,0 +1,213 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdio.h>      // snprintf
+#include <string.h>     // strlen
+#include <stdlib.h>     // rand
+#include <arpa/inet.h>  // inet_pton
+#include <sys/random.h> // getrandom
+#include "hello.h"
+
+// Cipher suites offered: the TLS 1.3 ones, then the common TLS 1.2 AEAD suites
+static const uint16_t suites[] = {
+  0x1301, 0x1302, 0x1303, 0xc02b, 0xc02f, 0xc02c, 0xc030, 0xcca9, 0xcca8, 0x009c, 0x009d
+};
+// ECDSA, RSA-PSS and RSA PKCS#1 with SHA-256, 384 and 512
+static const uint16_t sigalgs[] = {
+  0x0403, 0x0804, 0x0401, 0x0503, 0x0805, 0x0501, 0x0806, 0x0601
+};
+
+/*********************************************
+ * put16 - Append a big endian 16 bit number *
+ *********************************************/
+static uint8_t *put16(uint8_t *p, unsigned v) {
+  p[0] = v >> 8;
+  p[1] = v;
+  return p + 2;
+}
+
+/*********************************************
+ * put24 - Append a big endian 24 bit number *
+ *********************************************/
+static uint8_t *put24(uint8_t *p, unsigned v) {
+  p[0] = v >> 16;
+  return put16(p + 1, v);
+}
+
+/****************************************************
+ * random_bytes - Fill buf from the kernel's random *
+ *                pool                              *
+ ****************************************************/
+static void random_bytes(uint8_t *buf, size_t len) {
+  size_t i;
+  if (getrandom(buf, len, GRND_NONBLOCK) == (ssize_t)len) return;
+  for (i = 0; i < len; i++) buf[i] = rand();
+}
+
+/*******************************************************
+ * build_tls - Write a ClientHello record              *
+ *                                                     *
+ * Offers TLS 1.3 with an X25519 key share, so a 1.3   *
+ * server answers straight away, and TLS 1.2 for older *
+ * ones.  Nothing is encrypted before the ServerHello, *
+ * which is as far as a probe goes, so the key share   *
+ * can be any 32 bytes.  An address gets no SNI.       *
+ * Returns the length, -1 if it does not fit.          *
+ *******************************************************/
+static int build_tls(const char *host, uint8_t *buf, size_t size) {
+  uint8_t addr[16];
+  uint8_t *p = buf, *record, *handshake, *exts;
+  size_t host_len = strlen(host);
+  int sni = host_len && host_len < 256 && inet_pton(AF_INET, host, addr) != 1 && inet_pton(AF_INET6, host, addr) != 1;
+  size_t i;
+
+  if (size < 320 + host_len) return -1;
+
+  // Record header, handshake header, version, random and a compatibility session id
+  *p++ = 0x16;
+  p = put16(p, 0x0301);
+  record = p;
+  p += 2;
+  *p++ = 0x01;
+  handshake = p;
+  p += 3;
+  p = put16(p, 0x0303);
+  random_bytes(p, 32);
+  p += 32;
+  *p++ = 32;
+  random_bytes(p, 32);
+  p += 32;
+
+  p = put16(p, sizeof(suites));
+  for (i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) p = put16(p, suites[i]);
+  *p++ = 1; // Compression methods, only null
+  *p++ = 0;
+
+  exts = p;
+  p += 2;
+  if (sni) {
+    p = put16(p, 0x0000); // server_name
+    p = put16(p, host_len + 5);
+    p = put16(p, host_len + 3);
+    *p++ = 0;
+    p = put16(p, host_len);
+    memcpy(p, host, host_len);
+    p += host_len;
+  }
+  p = put16(p, 0x000a); // supported_groups: x25519, secp256r1
+  p = put16(p, 6);
+  p = put16(p, 4);
+  p = put16(p, 0x001d);
+  p = put16(p, 0x0017);
+  p = put16(p, 0x000b); // ec_point_formats: uncompressed
+  p = put16(p, 2);
+  *p++ = 1;
+  *p++ = 0;
+  p = put16(p, 0x000d); // signature_algorithms
+  p = put16(p, sizeof(sigalgs) + 2);
+  p = put16(p, sizeof(sigalgs));
+  for (i = 0; i < sizeof(sigalgs) / sizeof(sigalgs[0]); i++) p = put16(p, sigalgs[i]);
+  p = put16(p, 0x002b); // supported_versions: TLS 1.3, 1.2
+  p = put16(p, 5);
+  *p++ = 4;
+  p = put16(p, 0x0304);
+  p = put16(p, 0x0303);
+  p = put16(p, 0x002d); // psk_key_exchange_modes: psk_dhe_ke
+  p = put16(p, 2);
+  *p++ = 1;
+  *p++ = 1;
+  p = put16(p, 0x0033); // key_share: one x25519 key
+  p = put16(p, 38);
+  p = put16(p, 36);
+  p = put16(p, 0x001d);
+  p = put16(p, 32);
+  random_bytes(p, 32);
+  p += 32;
+
+  // Fill in the lengths now that everything is in place
+  put16(exts, p - exts - 2);
+  put24(handshake, p - handshake - 3);
+  put16(record, p - record - 2);
+  return p - buf;
+}
+
+/*******************************************************
+ * hello_build - Write what a probe sends once it has  *
+ *               connected                             *
+ *                                                     *
+ * host is the name the target was given as; HTTP      *
+ * requests carry it in the Host header and TLS in the *
+ * server name extension.                              *
+ * Returns the length, 0 when nothing is sent, -1 if   *
+ * it does not fit in size bytes.                      *
+ *******************************************************/
+int hello_build(hello_mode mode, const char *host, int port, uint8_t *buf, size_t size) {
+  char authority[300];
+  int n;
+
+  if (mode == HELLO_TLS) return build_tls(host, buf, size);
+  if (mode != HELLO_HTTP) return 0;
+  if (strchr(host, ':')) n = snprintf(authority, sizeof(authority), "[%s]", host);
+  else n = snprintf(authority, sizeof(authority), "%s", host);
+  if (port != 80 && n >= 0 && (size_t)n < sizeof(authority))
+    snprintf(authority + n, sizeof(authority) - n, ":%d", port);
+  n = snprintf((char *)buf, size, "HEAD / HTTP/1.1\r\nHost: %s\r\nUser-Agent: tcpping\r\nAccept: */*\r\nConnection: close\r\n\r\n", authority);
+  return n < 0 || (size_t)n >= size ? -1 : n;
+}
+
+/*****************************************************
+ * hello_reply - Look at the first bytes of a reply  *
+ *                                                   *
+ * An HTTP probe is answered by any byte and a stamp *
+ * one by a whole timestamp.  A TLS one needs the    *
+ * record and handshake headers to see a ServerHello *
+ * (a HelloRetryRequest is one too); an alert or     *
+ * anything else is a failure.                       *
+ * Returns 1 when answered, 0 if more bytes are      *
+ * needed, -1 if the reply is not what was asked.    *
+ *****************************************************/
+int hello_reply(hello_mode mode, const uint8_t *reply, int len) {
+  if (mode == HELLO_STAMP) return len >= STAMP_LEN;
+  if (mode != HELLO_TLS) return len > 0;
+  if (len < 1) return 0;
+  if (reply[0] != 0x16) return -1;
+  if (len < HELLO_REPLY) return 0;
+  return reply[5] == 0x02 ? 1 : -1;
+}
+
+/********************************************
+ * hello_name - What the reply is called in *
+ *              output                      *
+ ********************************************/
+const char *hello_name(hello_mode mode) {
+  if (mode == HELLO_TLS) return "tls";
+  if (mode == HELLO_HTTP) return "ttfb";
+  if (mode == HELLO_STAMP) return "stamp";
+  return "";
+}
+
+/****************************************************
+ * stamp_put - Write a wall clock time in the order *
+ *             it travels                           *
+ *                                                  *
+ * Nanoseconds since the epoch, big endian, in      *
+ * STAMP_LEN bytes.                                 *
+ ****************************************************/
+void stamp_put(uint8_t *buf, int64_t ns) {
+  int i;
+  for (i = STAMP_LEN - 1; i >= 0; i--, ns >>= 8) buf[i] = ns;
+}
+
+/*******************************************
+ * stamp_get - Read a time stamp_put wrote *
+ *******************************************/
+int64_t stamp_get(const uint8_t *buf) {
+  uint64_t ns = 0;
+  int i;
+  for (i = 0; i < STAMP_LEN; i++) ns = ns << 8 | buf[i];
+  return (int64_t)ns;
+}
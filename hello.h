@@ -0,0 +1,35 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef HELLO_H
+#define HELLO_H
+
+#include <stdint.h> // uint8_t
+#include <stddef.h> // size_t
+
+#define HELLO_MAX   640 // Longest request built
+#define HELLO_REPLY 8   // Reply bytes needed to recognize an answer
+#define STAMP_LEN   8   // Timestamp a --listen --stamp server sends
+
+/****************************************************
+ * What is sent once the TCP handshake is done, and *
+ * what answer ends the probe                       *
+ ****************************************************/
+typedef enum {
+  HELLO_NONE = 0, // Plain ping, done at the SYN-ACK
+  HELLO_TLS,      // ClientHello, done at the ServerHello
+  HELLO_HTTP,     // HTTP request, done at the first response byte
+  HELLO_STAMP     // Nothing, done at the timestamp of a --stamp listener
+} hello_mode;
+
+int hello_build(hello_mode mode, const char *host, int port, uint8_t *buf, size_t size);
+int hello_reply(hello_mode mode, const uint8_t *reply, int len);
+const char *hello_name(hello_mode mode);
+void stamp_put(uint8_t *buf, int64_t ns);
+int64_t stamp_get(const uint8_t *buf);
+
+#endif
@@ -0,0 +1,101 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <string.h> // memset
+#include "hist.h"
+
+#define SUB_COUNT (1 << HIST_SUB_BITS)
+
+/*********************************
+ * hist_init - Empty a histogram *
+ *********************************/
+void hist_init(struct histogram *h) {
+  memset(h, 0, sizeof(*h));
+}
+
+/*****************************************************
+ * hist_index - Bucket holding a value in ns         *
+ *                                                   *
+ * Small values map one to one, larger ones keep the *
+ * top HIST_SUB_BITS bits below the leading one bit. *
+ *****************************************************/
+int hist_index(int64_t ns) {
+  uint64_t units;
+  int msb, shift, idx;
+
+  if (ns <= 0) return 0;
+  units = (uint64_t)ns >> HIST_UNIT_SHIFT;
+  if (units < SUB_COUNT) return (int)units;
+
+  msb = 63 - __builtin_clzll(units);
+  shift = msb - HIST_SUB_BITS;
+  idx = ((shift + 1) << HIST_SUB_BITS) + (int)((units >> shift) - SUB_COUNT);
+  return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+/***************************************************
+ * hist_bucket_low - Smallest ns value of a bucket *
+ ***************************************************/
+int64_t hist_bucket_low(int idx) {
+  int shift;
+
+  if (idx < SUB_COUNT) return (int64_t)idx << HIST_UNIT_SHIFT;
+  shift = (idx >> HIST_SUB_BITS) - 1;
+  return (int64_t)(SUB_COUNT + (idx & (SUB_COUNT - 1))) << (shift + HIST_UNIT_SHIFT);
+}
+
+/***************************************************
+ * hist_bucket_high - First ns value past a bucket *
+ ***************************************************/
+int64_t hist_bucket_high(int idx) {
+  int shift;
+
+  if (idx < SUB_COUNT) return (int64_t)(idx + 1) << HIST_UNIT_SHIFT;
+  shift = (idx >> HIST_SUB_BITS) - 1;
+  return hist_bucket_low(idx) + ((int64_t)1 << (shift + HIST_UNIT_SHIFT));
+}
+
+/*************************************************
+ * hist_record - Count one value, O(1) and never *
+ *               allocates                       *
+ *************************************************/
+void hist_record(struct histogram *h, int64_t ns) {
+  h->counts[hist_index(ns)]++;
+  h->total++;
+}
+
+/***********************************************
+ * hist_merge - Add one histogram into another *
+ ***********************************************/
+void hist_merge(struct histogram *into, const struct histogram *from) {
+  int i;
+  for (i = 0; i < HIST_BUCKETS; i++) into->counts[i] += from->counts[i];
+  into->total += from->total;
+}
+
+/*******************************************************
+ * hist_percentile - Value below which pct percent of  *
+ *                   the recorded values fall          *
+ *                                                     *
+ * Returns the middle of the bucket holding that rank, *
+ * or 0 when the histogram is empty.                   *
+ *******************************************************/
+int64_t hist_percentile(const struct histogram *h, double pct) {
+  uint64_t rank, seen = 0;
+  int i;
+
+  if (h->total == 0) return 0;
+  rank = (uint64_t)(pct / 100.0 * h->total + 0.999999);
+  if (rank < 1) rank = 1;
+  if (rank > h->total) rank = h->total;
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank) break;
+  }
+  if (i == HIST_BUCKETS) i--;
+  return (hist_bucket_low(i) + hist_bucket_high(i)) / 2;
+}
@@ -0,0 +1,41 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h> // uint64_t
+
+/*****************************************************
+ * Histogram geometry                                *
+ *                                                   *
+ * Values are nanoseconds counted in 16 ns units.    *
+ * Every power of two is split into 16 linear        *
+ * sub-buckets, so a bucket is never wider than 1/16 *
+ * of its value and reporting the bucket middle is   *
+ * within about 3%.  Anything past 2^36 ns (68 s)    *
+ * lands in the last bucket.                         *
+ *****************************************************/
+#define HIST_UNIT_SHIFT 4  // log2 of the unit in ns
+#define HIST_SUB_BITS   4  // log2 of sub-buckets per power of two
+#define HIST_MAX_BITS   36 // log2 of the largest value in ns
+#define HIST_BUCKETS    ((HIST_MAX_BITS - HIST_UNIT_SHIFT - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+struct histogram {
+  uint64_t total;                 // Values recorded
+  uint64_t counts[HIST_BUCKETS];  // Values per bucket, wide enough never to wrap
+};
+
+void hist_init(struct histogram *h);
+void hist_record(struct histogram *h, int64_t ns);
+void hist_merge(struct histogram *into, const struct histogram *from);
+int64_t hist_percentile(const struct histogram *h, double pct);
+int hist_index(int64_t ns);
+int64_t hist_bucket_low(int idx);
+int64_t hist_bucket_high(int idx);
+
+#endif
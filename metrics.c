@@ -0,0 +1,477 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#define _GNU_SOURCE     // accept4
+#include <stdio.h>      // snprintf
+#include <stdlib.h>     // malloc
+#include <string.h>     // memcpy
+#include <stdarg.h>     // va_list
+#include <ctype.h>      // isdigit
+#include <unistd.h>     // close
+#include <errno.h>      // errno
+#include <arpa/inet.h>  // inet_pton
+#include <sys/socket.h> // socket
+#include <sys/epoll.h>  // epoll
+#include "metrics.h"
+#include "engine.h"
+
+#define LISTEN_EVENT UINT64_MAX // epoll data marking the listening socket
+
+// Bucket bounds in ns and as written in the le label
+static const int64_t bucket_ns[METRICS_BUCKETS - 1] = {
+  100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 25000000,
+  50000000, 100000000, 250000000, 500000000, 1000000000, 2500000000LL, 5000000000LL
+};
+static const char *bucket_le[METRICS_BUCKETS] = {
+  "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025",
+  "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "+Inf"
+};
+
+// Metric families in the order they are written
+static const char *families[] = {
+  "# HELP tcpping_pings_total Pings finished.\n# TYPE tcpping_pings_total counter\n",
+  "# HELP tcpping_success_total Pings that completed the handshake.\n# TYPE tcpping_success_total counter\n",
+  "# HELP tcpping_failures_total Pings that failed, by reason.\n# TYPE tcpping_failures_total counter\n",
+  "# HELP tcpping_rtt_seconds Round trip time of successful pings.\n# TYPE tcpping_rtt_seconds histogram\n",
+  "# HELP tcpping_failure_seconds Time until a RST or ICMP error answered a ping.\n# TYPE tcpping_failure_seconds histogram\n"
+};
+#define FAMILIES 5
+
+/****************************************************
+ * metrics_parse - Read PORT, ADDR:PORT or          *
+ *                 [ADDR]:PORT                      *
+ *                                                  *
+ * A bare port listens on every address.            *
+ * Returns 0 on success, -1 if it cannot be parsed. *
+ ****************************************************/
+int metrics_parse(const char *str, union sockaddr_any *addr) {
+  char host[64];
+  const char *port_str = strrchr(str, ':');
+  char *end;
+  size_t len;
+  long port;
+
+  if (!port_str) port_str = str;
+  else port_str++;
+  port = strtol(port_str, &end, 10);
+  if (!isdigit((unsigned char)*port_str) || *end || port < 1 || port > 65535) return -1;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->in6.sin6_family = AF_INET6;
+  addr->in6.sin6_port = htons(port);
+  addr->in6.sin6_addr = in6addr_any;
+  if (port_str == str) return 0;
+
+  // Address in front of the port, IPv6 in brackets
+  len = port_str - 1 - str;
+  if (len >= 2 && str[0] == '[' && str[len - 1] == ']') {
+    str++;
+    len -= 2;
+  }
+  if (len == 0 || len >= sizeof(host)) return -1;
+  memcpy(host, str, len);
+  host[len] = 0;
+  if (inet_pton(AF_INET6, host, &addr->in6.sin6_addr) == 1) return 0;
+  memset(addr, 0, sizeof(*addr));
+  addr->in4.sin_family = AF_INET;
+  addr->in4.sin_port = htons(port);
+  return inet_pton(AF_INET, host, &addr->in4.sin_addr) == 1 ? 0 : -1;
+}
+
+/*********************************************************
+ * listen_on - Open the listening socket                 *
+ *                                                       *
+ * The any address is tried as dual-stack IPv6 first and *
+ * as IPv4 on hosts without IPv6.                        *
+ * Returns the socket, -1 with errno set on failure.     *
+ *********************************************************/
+static int listen_on(const union sockaddr_any *addr) {
+  union sockaddr_any any4;
+  int fd, one = 1, zero = 0;
+
+  fd = socket(addr->sa.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 && errno == EAFNOSUPPORT && addr->sa.sa_family == AF_INET6 &&
+      memcmp(&addr->in6.sin6_addr, &in6addr_any, 16) == 0) {
+    memset(&any4, 0, sizeof(any4));
+    any4.in4.sin_family = AF_INET;
+    any4.in4.sin_port = addr->in6.sin6_port;
+    return listen_on(&any4);
+  }
+  if (fd < 0) return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (addr->sa.sa_family == AF_INET6) setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+  if (bind(fd, &addr->sa, sockaddr_len(addr)) < 0 || listen(fd, 64) < 0) {
+    one = errno;
+    close(fd);
+    errno = one;
+    return -1;
+  }
+  return fd;
+}
+
+/***************************************************
+ * escape_label - Quote a label value              *
+ *                                                 *
+ * Backslash, double quote and newline are escaped *
+ * as the exposition format requires.              *
+ ***************************************************/
+static char *escape_label(const char *value) {
+  char *label = malloc(strlen(value) * 2 + 16), *p;
+
+  if (!label) return NULL;
+  p = label + sprintf(label, "target=\"");
+  for (; *value; value++) {
+    if (*value == '\\' || *value == '"') *p++ = '\\';
+    if (*value == '\n') {
+      *p++ = '\\';
+      *p++ = 'n';
+      continue;
+    }
+    *p++ = *value;
+  }
+  strcpy(p, "\"");
+  return label;
+}
+
+/*****************************************************
+ * metrics_init - Start serving /metrics on addr     *
+ *                                                   *
+ * labels names each target in the exported series.  *
+ * Returns 0 on success, -1 with errno set on error. *
+ *****************************************************/
+int metrics_init(struct metrics_server *m, const union sockaddr_any *addr, const char **labels, int ntargets) {
+  struct epoll_event ev;
+  int i;
+
+  memset(m, 0, sizeof(*m));
+  m->epfd = -1;
+  for (i = 0; i < METRICS_CLIENTS; i++) m->clients[i].fd = -1;
+  m->listen_fd = listen_on(addr);
+  if (m->listen_fd < 0) return -1;
+  m->epfd = epoll_create1(EPOLL_CLOEXEC);
+  ev.events = EPOLLIN;
+  ev.data.u64 = LISTEN_EVENT;
+  if (m->epfd < 0 || epoll_ctl(m->epfd, EPOLL_CTL_ADD, m->listen_fd, &ev) < 0) {
+    metrics_free(m);
+    return -1;
+  }
+
+  m->targets = calloc(ntargets, sizeof(struct metrics_target));
+  if (!m->targets) {
+    metrics_free(m);
+    errno = ENOMEM;
+    return -1;
+  }
+  m->ntargets = ntargets;
+  for (i = 0; i < ntargets; i++) {
+    m->targets[i].label = escape_label(labels[i]);
+    m->targets[i].dirty = TRUE;
+    if (!m->targets[i].label) {
+      metrics_free(m);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/****************************************************
+ * metrics_record - Count one finished ping         *
+ *                                                  *
+ * Only marks the target for re-rendering; the text *
+ * is brought up to date when it is next scraped.   *
+ ****************************************************/
+void metrics_record(struct metrics_server *m, int target, probe_reason reason, int64_t rtt_ns) {
+  struct metrics_target *t = &m->targets[target];
+  int b;
+
+  t->pings++;
+  t->dirty = TRUE;
+  for (b = 0; b < METRICS_BUCKETS - 1 && rtt_ns > bucket_ns[b]; b++);
+  if (reason == REASON_OK) {
+    t->success++;
+    t->rtt_sum_ns += rtt_ns;
+    t->buckets[b]++;
+    return;
+  }
+  if (reason >= PROBE_REASONS) reason = REASON_OTHER;
+  t->failures[reason]++;
+  if (reason == REASON_REFUSED) {
+    t->refused_buckets[b]++;
+    t->refused_sum_ns += rtt_ns;
+  }
+  if (reason == REASON_UNREACHABLE) {
+    t->unreachable_buckets[b]++;
+    t->unreachable_sum_ns += rtt_ns;
+  }
+}
+
+/****************************************************
+ * append - Add formatted text to a growable buffer *
+ *                                                  *
+ * Returns 0 on success, -1 when out of memory.     *
+ ****************************************************/
+static int append(char **buf, size_t *len, size_t *size, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+static int append(char **buf, size_t *len, size_t *size, const char *fmt, ...) {
+  va_list ap;
+  size_t need;
+  char *grown;
+  int n;
+
+  for (;;) {
+    va_start(ap, fmt);
+    n = vsnprintf(*buf ? *buf + *len : NULL, *buf ? *size - *len : 0, fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    if (*buf && *len + n < *size) break;
+    need = *size ? *size * 2 : 4096;
+    while (need <= *len + n) need *= 2;
+    if ((grown = realloc(*buf, need)) == NULL) return -1;
+    *buf = grown;
+    *size = need;
+  }
+  *len += n;
+  return 0;
+}
+
+/***************************************************
+ * append_hist - Add the lines of one histogram    *
+ *                                                 *
+ * labels are the target's labels with any others. *
+ * Returns 0 on success, -1 when out of memory.    *
+ ***************************************************/
+static int append_hist(struct metrics_target *t, const char *name, const char *labels,
+                       const uint64_t *buckets, int64_t sum_ns, uint64_t count) {
+  uint64_t cumulative = 0;
+  int b, ok = 0;
+
+  for (b = 0; b < METRICS_BUCKETS; b++) {
+    cumulative += buckets[b];
+    ok |= append(&t->text, &t->len, &t->size, "%s_bucket{%s,le=\"%s\"} %llu\n",
+                 name, labels, bucket_le[b], (unsigned long long)cumulative);
+  }
+  ok |= append(&t->text, &t->len, &t->size, "%s_sum{%s} %.9f\n%s_count{%s} %llu\n",
+               name, labels, (double)sum_ns / NSEC_PER_SEC, name, labels, (unsigned long long)count);
+  return ok;
+}
+
+/************************************************
+ * render - Bring one target's lines up to date *
+ *                                              *
+ * Failure time histograms only appear once the *
+ * target has had that kind of failure.         *
+ ************************************************/
+static void render(struct metrics_target *t) {
+  char labels[2048];    // The target's labels plus the reason
+  int r, ok = 0;
+
+  t->len = 0;
+  t->off[0] = 0;
+  ok |= append(&t->text, &t->len, &t->size, "tcpping_pings_total{%s} %llu\n", t->label, (unsigned long long)t->pings);
+  t->off[1] = t->len;
+  ok |= append(&t->text, &t->len, &t->size, "tcpping_success_total{%s} %llu\n", t->label, (unsigned long long)t->success);
+  t->off[2] = t->len;
+  for (r = REASON_OK + 1; r < PROBE_REASONS; r++)
+    ok |= append(&t->text, &t->len, &t->size, "tcpping_failures_total{%s,reason=\"%s\"} %llu\n",
+                 t->label, probe_reason_name(r), (unsigned long long)t->failures[r]);
+  t->off[3] = t->len;
+  ok |= append_hist(t, "tcpping_rtt_seconds", t->label, t->buckets, t->rtt_sum_ns, t->success);
+  t->off[4] = t->len;
+  if (t->failures[REASON_REFUSED]) {
+    snprintf(labels, sizeof(labels), "%s,reason=\"refused\"", t->label);
+    ok |= append_hist(t, "tcpping_failure_seconds", labels, t->refused_buckets, t->refused_sum_ns, t->failures[REASON_REFUSED]);
+  }
+  if (t->failures[REASON_UNREACHABLE]) {
+    snprintf(labels, sizeof(labels), "%s,reason=\"unreachable\"", t->label);
+    ok |= append_hist(t, "tcpping_failure_seconds", labels, t->unreachable_buckets, t->unreachable_sum_ns, t->failures[REASON_UNREACHABLE]);
+  }
+  t->off[5] = t->len;
+  // Out of memory leaves the target marked so it is tried again
+  t->dirty = ok < 0;
+  if (ok < 0) memset(t->off, 0, sizeof(t->off));
+}
+
+/***************************************************
+ * build_page - Assemble the response to a scrape  *
+ *                                                 *
+ * Only targets that changed since the last scrape *
+ * are formatted again; everything else is copied  *
+ * from the text kept for it.                      *
+ ***************************************************/
+static void build_page(struct metrics_server *m) {
+  struct metrics_target *t;
+  size_t body = 0, head;
+  char header[128];
+  int i, f;
+
+  for (i = 0; i < m->ntargets; i++) {
+    t = &m->targets[i];
+    if (t->dirty) render(t);
+    body += t->off[FAMILIES];
+  }
+  for (f = 0; f < FAMILIES; f++) body += strlen(families[f]);
+  head = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                  "Content-Length: %zu\r\nConnection: close\r\n\r\n", body);
+
+  m->page_len = 0;
+  if (head + body > m->page_size) {
+    free(m->page);
+    m->page_size = (head + body) * 5 / 4;
+    if ((m->page = malloc(m->page_size)) == NULL) {
+      m->page_size = 0;
+      return;
+    }
+  }
+  memcpy(m->page, header, head);
+  m->page_len = head;
+  for (f = 0; f < FAMILIES; f++) {
+    memcpy(m->page + m->page_len, families[f], strlen(families[f]));
+    m->page_len += strlen(families[f]);
+    for (i = 0; i < m->ntargets; i++) {
+      t = &m->targets[i];
+      memcpy(m->page + m->page_len, t->text + t->off[f], t->off[f + 1] - t->off[f]);
+      m->page_len += t->off[f + 1] - t->off[f];
+    }
+  }
+}
+
+/************************************
+ * drop - Close a client connection *
+ ************************************/
+static void drop(struct metrics_server *m, struct metrics_client *c) {
+  if (c->out && c->out == m->page) m->sending--;
+  close(c->fd); // Also leaves the epoll set
+  c->fd = -1;
+  c->out = NULL;
+}
+
+/****************************************************
+ * send_more - Write as much of the response as the *
+ *             socket takes                         *
+ ****************************************************/
+static void send_more(struct metrics_server *m, struct metrics_client *c) {
+  struct epoll_event ev;
+  ssize_t n;
+
+  while (c->sent < c->out_len) {
+    n = send(c->fd, c->out + c->sent, c->out_len - c->sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EAGAIN) {
+      // Wait for room, no longer for more request
+      ev.events = EPOLLOUT;
+      ev.data.u64 = c - m->clients;
+      epoll_ctl(m->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+      return;
+    }
+    if (n <= 0) break;
+    c->sent += n;
+  }
+  drop(m, c);
+}
+
+/****************************************************
+ * serve - Read a request and start the response    *
+ *                                                  *
+ * Only the request line matters; GET /metrics gets *
+ * the exposition text, anything else a 404.  While *
+ * an earlier scrape is still being written, a new  *
+ * one shares its page rather than rebuilding it.   *
+ ****************************************************/
+static void serve(struct metrics_server *m, struct metrics_client *c) {
+  static const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 10\r\nConnection: close\r\n\r\nNot Found\n";
+  ssize_t n;
+
+  n = recv(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len, 0);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+  if (n <= 0) {
+    drop(m, c);
+    return;
+  }
+  c->req_len += n;
+  c->req[c->req_len] = 0;
+  if (!strstr(c->req, "\r\n\r\n") && !strstr(c->req, "\n\n")) {
+    if (c->req_len == sizeof(c->req) - 1) drop(m, c);
+    return;
+  }
+
+  if (strncmp(c->req, "GET /metrics ", 13) == 0 || strncmp(c->req, "GET /metrics?", 13) == 0) {
+    if (m->sending == 0) build_page(m);
+    if (m->page_len == 0) {
+      drop(m, c);
+      return;
+    }
+    m->sending++;
+    m->scrapes++;
+    c->out = m->page;
+    c->out_len = m->page_len;
+  } else {
+    c->out = not_found;
+    c->out_len = sizeof(not_found) - 1;
+  }
+  c->sent = 0;
+  send_more(m, c);
+}
+
+/***************************************************
+ * metrics_poll - Handle whatever is ready         *
+ *                                                 *
+ * Called by the engine when the private epoll set *
+ * turns readable; never blocks.  A new connection *
+ * beyond METRICS_CLIENTS is closed right away.    *
+ ***************************************************/
+void metrics_poll(void *ctx) {
+  struct metrics_server *m = ctx;
+  struct epoll_event events[METRICS_CLIENTS + 1], ev;
+  struct metrics_client *c;
+  int n, i, j, fd;
+
+  n = epoll_wait(m->epfd, events, METRICS_CLIENTS + 1, 0);
+  for (i = 0; i < n; i++) {
+    if (events[i].data.u64 == LISTEN_EVENT) {
+      while ((fd = accept4(m->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        for (j = 0; j < METRICS_CLIENTS && m->clients[j].fd >= 0; j++);
+        ev.events = EPOLLIN;
+        ev.data.u64 = j;
+        if (j == METRICS_CLIENTS || epoll_ctl(m->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+          close(fd);
+          continue;
+        }
+        c = &m->clients[j];
+        c->fd = fd;
+        c->req_len = 0;
+        c->out = NULL;
+      }
+      continue;
+    }
+    c = &m->clients[events[i].data.u64];
+    if (c->fd < 0) continue;
+    if (c->out) send_more(m, c);
+    else serve(m, c);
+  }
+}
+
+/**********************************************
+ * metrics_free - Close every socket and free *
+ *                the rendered text           *
+ **********************************************/
+void metrics_free(struct metrics_server *m) {
+  int i;
+
+  for (i = 0; i < METRICS_CLIENTS; i++)
+    if (m->clients[i].fd >= 0) close(m->clients[i].fd);
+  for (i = 0; m->targets && i < m->ntargets; i++) {
+    free(m->targets[i].label);
+    free(m->targets[i].text);
+  }
+  if (m->listen_fd >= 0) close(m->listen_fd);
+  if (m->epfd >= 0) close(m->epfd);
+  free(m->targets);
+  free(m->page);
+  memset(m, 0, sizeof(*m));
+  m->listen_fd = -1;
+  m->epfd = -1;
+}
@@ -0,0 +1,76 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h> // int64_t
+#include <stddef.h> // size_t
+#include "tcpping.h"
+
+#define METRICS_BUCKETS 16   // Rtt histogram buckets, +Inf included
+#define METRICS_CLIENTS 16   // Scrapes served at once
+#define METRICS_REQUEST 2048 // Longest request header accepted
+
+/*****************************************************
+ * metrics_target - Exported counters of one target  *
+ *                                                   *
+ * text holds the target's lines of every metric     *
+ * family, rendered the last time it changed; off[f] *
+ * is where family f starts.                         *
+ *****************************************************/
+struct metrics_target {
+  uint64_t pings, success;
+  uint64_t failures[PROBE_REASONS]; // Failures by reason, REASON_OK unused
+  uint64_t buckets[METRICS_BUCKETS]; // Successes per rtt bucket, not cumulative
+  int64_t rtt_sum_ns;   // Sum of successful rtts
+  uint64_t refused_buckets[METRICS_BUCKETS];     // RSTs per time bucket
+  int64_t refused_sum_ns;                         // Sum of times to a RST
+  uint64_t unreachable_buckets[METRICS_BUCKETS]; // ICMP errors per time bucket
+  int64_t unreachable_sum_ns;                     // Sum of times to an ICMP error
+  boolean dirty;        // Changed since text was rendered
+  char *label;          // target="...", escaped once
+  char *text;           // Rendered lines
+  size_t len, size;     // Bytes used and allocated
+  size_t off[6];        // Start of each family in text, plus the end
+};
+
+struct metrics_client {
+  int fd;               // Connection, -1 when free
+  char req[METRICS_REQUEST]; // Request read so far
+  size_t req_len;       // Bytes of it
+  const char *out;      // Response being sent
+  size_t out_len;       // Its length
+  size_t sent;          // Bytes of it written
+};
+
+/*****************************************************
+ * metrics_server - Prometheus exposition over HTTP  *
+ *                                                   *
+ * The listening socket and the connections live in  *
+ * a private epoll set, which the probe engine waits *
+ * on as a single descriptor.                        *
+ *****************************************************/
+struct metrics_server {
+  int listen_fd;        // Listening socket
+  int epfd;             // epoll set of the listener and clients
+  struct metrics_target *targets;
+  int ntargets;
+  struct metrics_client clients[METRICS_CLIENTS];
+  int sending;          // Clients still writing the response
+  char *page;           // Last rendered response
+  size_t page_len, page_size;
+  uint64_t scrapes;     // Requests for /metrics served
+};
+
+int metrics_parse(const char *str, union sockaddr_any *addr);
+int metrics_init(struct metrics_server *m, const union sockaddr_any *addr, const char **labels, int ntargets);
+void metrics_record(struct metrics_server *m, int target, probe_reason reason, int64_t rtt_ns);
+void metrics_poll(void *ctx);
+void metrics_free(struct metrics_server *m);
+
+#endif
@@ -0,0 +1,138 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy
+#include <unistd.h> // write
+#include <errno.h>  // errno
+#include "out.h"
+
+/****************************************
+ * out_init - Set up a writer for fd    *
+ *                                      *
+ * Returns 0 on success, -1 when out of *
+ * memory.                              *
+ ****************************************/
+int out_init(struct out_buffer *ob, int fd) {
+  ob->fd = fd;
+  ob->len = 0;
+  ob->flush_ns = INT64_MAX;
+  ob->buf = malloc(OUT_SIZE);
+  return ob->buf ? 0 : -1;
+}
+
+/***************************************************
+ * out_free - Write what is left and free a writer *
+ ***************************************************/
+void out_free(struct out_buffer *ob) {
+  if (!ob->buf) return;
+  out_flush(ob);
+  free(ob->buf);
+  ob->buf = NULL;
+}
+
+/***************************************************
+ * out_mem - Append bytes                          *
+ *                                                 *
+ * Callers keep records under OUT_RECORD bytes and *
+ * out_end() keeps that much room free, so appends *
+ * never check for space.                          *
+ ***************************************************/
+void out_mem(struct out_buffer *ob, const char *s, size_t len) {
+  memcpy(ob->buf + ob->len, s, len);
+  ob->len += len;
+}
+
+/*******************************
+ * out_str - Append a C string *
+ *******************************/
+void out_str(struct out_buffer *ob, const char *s) {
+  out_mem(ob, s, strlen(s));
+}
+
+/***************************************************
+ * out_int - Append a decimal integer              *
+ *                                                 *
+ * Digits are produced backwards into a scratch    *
+ * buffer, which is a good deal cheaper than going *
+ * through printf() for every number.              *
+ ***************************************************/
+void out_int(struct out_buffer *ob, int64_t v) {
+  char digits[24];
+  char *p = digits + sizeof(digits);
+  uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0) *--p = '-';
+  out_mem(ob, p, digits + sizeof(digits) - p);
+}
+
+/**************************************************
+ * out_json - Append a string as a quoted JSON    *
+ *            string                              *
+ *                                                *
+ * Quotes, backslashes and control characters are *
+ * escaped, so n bytes can take up to OUT_JSON(n) *
+ * and records have to be sized by that.  The     *
+ * string is never cut short.                     *
+ **************************************************/
+void out_json(struct out_buffer *ob, const char *s) {
+  static const char hex[] = "0123456789abcdef";
+  char *p = ob->buf + ob->len;
+
+  *p++ = '"';
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      *p++ = '\\';
+      *p++ = *s;
+    } else if ((unsigned char)*s < 0x20) {
+      memcpy(p, "\\u00", 4);
+      p[4] = hex[(unsigned char)*s >> 4];
+      p[5] = hex[*s & 15];
+      p += 6;
+    } else {
+      *p++ = *s;
+    }
+  }
+  *p++ = '"';
+  ob->len = p - ob->buf;
+}
+
+/***************************************************
+ * out_end - Finish a record                       *
+ *                                                 *
+ * The first record after a flush starts the clock *
+ * for the next time-based one; a full buffer goes *
+ * out right away.                                 *
+ ***************************************************/
+void out_end(struct out_buffer *ob, int64_t now) {
+  if (ob->flush_ns == INT64_MAX) ob->flush_ns = now + OUT_DELAY_NS;
+  if (ob->len > OUT_SIZE - OUT_RECORD) out_flush(ob);
+}
+
+/************************************************
+ * out_flush - Write everything waiting         *
+ *                                              *
+ * Short writes are retried.  If the reader has *
+ * gone away the bytes are dropped.             *
+ ************************************************/
+void out_flush(struct out_buffer *ob) {
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < ob->len) {
+    n = write(ob->fd, ob->buf + done, ob->len - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    done += n;
+  }
+  ob->len = 0;
+  ob->flush_ns = INT64_MAX;
+}
@@ -0,0 +1,44 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef OUT_H
+#define OUT_H
+
+#include <stdint.h> // int64_t
+#include <stddef.h> // size_t
+
+#define OUT_SIZE      (1 << 20)  // Bytes buffered before a write()
+#define OUT_RECORD    4096       // Room kept free for one record
+#define OUT_JSON(n)   (6 * (n) + 2) // Most bytes out_json() writes for n input bytes
+#define OUT_DELAY_NS  100000000LL // Longest a record waits in the buffer
+
+/******************************************************
+ * out_buffer - Buffered writer for streamed records  *
+ *                                                    *
+ * Records are formatted straight into one large      *
+ * buffer and written out with a single write() once  *
+ * it fills up or the oldest record has waited        *
+ * OUT_DELAY_NS, so a fast stream costs a system call *
+ * per megabyte rather than per line.                 *
+ ******************************************************/
+struct out_buffer {
+  int fd;            // Where the records go
+  char *buf;         // OUT_SIZE bytes
+  size_t len;        // Bytes waiting
+  int64_t flush_ns;  // When the waiting bytes must go out, INT64_MAX if none
+};
+
+int out_init(struct out_buffer *ob, int fd);
+void out_free(struct out_buffer *ob);
+void out_str(struct out_buffer *ob, const char *s);
+void out_mem(struct out_buffer *ob, const char *s, size_t len);
+void out_int(struct out_buffer *ob, int64_t v);
+void out_json(struct out_buffer *ob, const char *s);
+void out_end(struct out_buffer *ob, int64_t now);
+void out_flush(struct out_buffer *ob);
+
+#endif
@@ -0,0 +1,177 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#define _GNU_SOURCE   // mremap
+#include <stdlib.h>   // malloc
+#include <string.h>   // memcpy
+#include <unistd.h>   // close
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <errno.h>    // errno
+#include "probelog.h"
+
+/***************************************************
+ * grow - Extend the file and its mapping          *
+ *                                                 *
+ * Space is reserved with fallocate() so appending *
+ * a record never faults on a full disk.           *
+ * Returns 0 on success, -1 on failure.            *
+ ***************************************************/
+static int grow(struct probe_log *log, size_t size) {
+  uint8_t *map;
+
+  if (posix_fallocate(log->fd, 0, size) != 0) return -1;
+  if (log->map) map = mremap(log->map, log->size, size, MREMAP_MAYMOVE);
+  else map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+  if (map == MAP_FAILED) return -1;
+  log->map = map;
+  log->size = size;
+  log->header = (struct plog_header *)map;
+  log->records = (struct plog_record *)(map + log->header->records_off);
+  log->capacity = (size - log->header->records_off) / sizeof(struct plog_record);
+  return 0;
+}
+
+/*****************************************************
+ * plog_create - Start a new log at path             *
+ *                                                   *
+ * Writes the header and target labels; an existing  *
+ * file is replaced.                                 *
+ * Returns 0 on success, -1 with errno set on error. *
+ *****************************************************/
+int plog_create(struct probe_log *log, const char *path, const char **labels, int ntargets, int64_t start_ns) {
+  struct plog_header header;
+  size_t names_len = 0, len;
+  uint64_t off;
+  char *names;
+  int i;
+
+  memset(log, 0, sizeof(*log));
+  for (i = 0; i < ntargets; i++) names_len += strlen(labels[i]) + 1;
+  off = (sizeof(header) + names_len + 4095) & ~(uint64_t)4095;
+
+  log->writing = 1;
+  log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (log->fd < 0) return -1;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PLOG_MAGIC, 8);
+  header.version = PLOG_VERSION;
+  header.record_size = sizeof(struct plog_record);
+  header.ntargets = ntargets;
+  header.names_len = names_len;
+  header.start_ns = start_ns;
+  header.records_off = off;
+  if (write(log->fd, &header, sizeof(header)) != sizeof(header) || grow(log, off + PLOG_GROW) < 0) {
+    plog_close(log);
+    return -1;
+  }
+  names = (char *)log->map + sizeof(header);
+  for (i = 0; i < ntargets; i++) {
+    len = strlen(labels[i]) + 1;
+    memcpy(names, labels[i], len);
+    names += len;
+  }
+  return 0;
+}
+
+/*****************************************************
+ * plog_append - Add one finished ping               *
+ *                                                   *
+ * sent_ns is on the wall clock.  When the file runs *
+ * out of room it is grown, and if that fails the    *
+ * record is dropped.                                *
+ *****************************************************/
+void plog_append(struct probe_log *log, int target, int64_t sent_ns, int64_t rtt_ns, int reason) {
+  struct plog_record *r;
+  uint64_t n = log->header->count;
+  int64_t sent = sent_ns - log->header->start_ns;
+
+  if (n == log->capacity && grow(log, log->size + PLOG_GROW) < 0) return;
+  if (sent < 0) sent = 0;
+  if (rtt_ns < 0) rtt_ns = 0;
+  if (rtt_ns > UINT32_MAX) rtt_ns = UINT32_MAX;
+  r = &log->records[n];
+  r->sent = (uint64_t)sent << 8 | (uint8_t)reason;
+  r->target = target;
+  r->rtt_ns = rtt_ns;
+  log->header->count = n + 1;
+}
+
+/**********************************************
+ * plog_close - Trim a log to its records and *
+ *              unmap it                      *
+ **********************************************/
+void plog_close(struct probe_log *log) {
+  size_t used = 0;
+
+  if (log->map) {
+    if (log->writing)
+      used = log->header->records_off + log->header->count * sizeof(struct plog_record);
+    munmap(log->map, log->size);
+  }
+  if (log->fd >= 0) {
+    // A failed trim only leaves preallocated space the reader ignores
+    if (used && ftruncate(log->fd, used) < 0) used = 0;
+    close(log->fd);
+  }
+  free(log->labels);
+  memset(log, 0, sizeof(*log));
+  log->fd = -1;
+}
+
+/*****************************************************
+ * plog_open - Map an existing log for reading       *
+ *                                                   *
+ * Returns 0 on success, -1 if the file cannot be    *
+ * read or is not a probe log (errno is then EINVAL) *
+ *****************************************************/
+int plog_open(struct probe_log *log, const char *path) {
+  struct plog_header *h;
+  struct stat st;
+  const char *name, *end;
+  uint32_t i;
+
+  memset(log, 0, sizeof(*log));
+  log->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (log->fd < 0 || fstat(log->fd, &st) < 0) goto fail;
+  if ((size_t)st.st_size < sizeof(struct plog_header)) goto invalid;
+  log->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, log->fd, 0);
+  if (log->map == MAP_FAILED) {
+    log->map = NULL;
+    goto fail;
+  }
+  log->size = st.st_size;
+  h = log->header = (struct plog_header *)log->map;
+  if (memcmp(h->magic, PLOG_MAGIC, 8) != 0 || h->version != PLOG_VERSION ||
+      h->record_size != sizeof(struct plog_record) || h->records_off > log->size ||
+      sizeof(*h) + h->names_len > h->records_off) goto invalid;
+  log->records = (struct plog_record *)(log->map + h->records_off);
+  log->capacity = (log->size - h->records_off) / sizeof(struct plog_record);
+  if (log->capacity > h->count) log->capacity = h->count;
+
+  // Index the labels, checking each one ends inside the table
+  log->labels = calloc(h->ntargets + 1, sizeof(char *));
+  if (!log->labels) goto fail;
+  name = (const char *)log->map + sizeof(*h);
+  end = name + h->names_len;
+  for (i = 0; i < h->ntargets; i++) {
+    log->labels[i] = name;
+    name = memchr(name, 0, end - name);
+    if (!name) goto invalid;
+    name++;
+  }
+  return 0;
+
+ invalid:
+  errno = EINVAL;
+ fail:
+  i = errno;
+  plog_close(log);
+  errno = i;
+  return -1;
+}
@@ -0,0 +1,72 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef PROBELOG_H
+#define PROBELOG_H
+
+#include <stdint.h> // int64_t
+#include <stddef.h> // size_t
+
+#define PLOG_MAGIC   "TCPPLOG1"
+#define PLOG_VERSION 1
+#define PLOG_GROW    (64 << 20) // Bytes the file is extended by at a time
+
+/******************************************************
+ * plog_header - Start of a probe log file            *
+ *                                                    *
+ * Followed by the NUL separated target labels, then  *
+ * the records from records_off on.  count is updated *
+ * after every record, so a log cut short by a crash  *
+ * is still readable up to the last whole record.     *
+ ******************************************************/
+struct plog_header {
+  char magic[8];         // PLOG_MAGIC
+  uint32_t version;      // PLOG_VERSION
+  uint32_t record_size;  // sizeof(struct plog_record)
+  uint32_t ntargets;     // Labels stored
+  uint32_t names_len;    // Bytes of labels
+  int64_t start_ns;      // Wall clock the log starts at, ns since the epoch
+  uint64_t records_off;  // File offset of the first record
+  uint64_t count;        // Records written
+  uint8_t pad[16];       // Keeps the header at 64 bytes
+};
+
+/****************************************************
+ * plog_record - One finished ping, 16 bytes        *
+ *                                                  *
+ * rtt_ns saturates at about 4.3 s; for a failure  *
+ * it is the time until the failure was known.  The *
+ * low byte of sent is the probe_reason, whose      *
+ * first three values are the ok, timeout and error *
+ * outcomes older logs stored.                      *
+ ****************************************************/
+struct plog_record {
+  uint64_t sent;     // ns after start_ns the ping went out << 8 | reason
+  uint32_t target;   // Target index
+  uint32_t rtt_ns;   // Round trip time
+};
+
+#define PLOG_SENT(r)    ((int64_t)((r)->sent >> 8))
+#define PLOG_OUTCOME(r) ((int)((r)->sent & 0xff))
+
+struct probe_log {
+  int fd;                     // Log file
+  uint8_t *map;               // Whole file mapped
+  size_t size;                // Bytes mapped
+  struct plog_header *header; // Start of the map
+  struct plog_record *records; // First record
+  uint64_t capacity;          // Records that fit in the map
+  int writing;                // Opened by plog_create()
+  const char **labels;        // Reader only: label of each target
+};
+
+int plog_create(struct probe_log *log, const char *path, const char **labels, int ntargets, int64_t start_ns);
+void plog_append(struct probe_log *log, int target, int64_t sent_ns, int64_t rtt_ns, int reason);
+void plog_close(struct probe_log *log);
+int plog_open(struct probe_log *log, const char *path);
+
+#endif
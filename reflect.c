@@ -0,0 +1,132 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#define _GNU_SOURCE      // accept4, CPU affinity
+#include <string.h>      // memset
+#include <errno.h>       // errno
+#include <unistd.h>      // close
+#include <sched.h>       // CPU_SET
+#include <sys/socket.h>  // socket, accept4
+#include <sys/epoll.h>   // epoll
+#include "reflect.h"
+#include "hello.h"
+
+/*********************************************************
+ * reflect_open - Open one listener's socket and epoll   *
+ *                set                                    *
+ *                                                       *
+ * The any address is tried as dual-stack IPv6 first and *
+ * as IPv4 on hosts without IPv6.  The other fields are  *
+ * left for the caller.                                  *
+ * Returns 0 on success, -1 with errno set on failure.   *
+ *********************************************************/
+int reflect_open(struct reflector *r, const union sockaddr_any *addr, int stop_fd) {
+  union sockaddr_any any4;
+  struct epoll_event ev;
+  int one = 1, zero = 0, saved;
+
+  r->fd = socket(addr->sa.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  r->epfd = -1;
+  r->stop_fd = stop_fd;
+  atomic_init(&r->accepted, 0);
+  atomic_init(&r->failed, 0);
+  if (r->fd < 0 && errno == EAFNOSUPPORT && addr->sa.sa_family == AF_INET6 &&
+      memcmp(&addr->in6.sin6_addr, &in6addr_any, 16) == 0) {
+    memset(&any4, 0, sizeof(any4));
+    any4.in4.sin_family = AF_INET;
+    any4.in4.sin_port = addr->in6.sin6_port;
+    return reflect_open(r, &any4, stop_fd);
+  }
+  if (r->fd < 0) return -1;
+  setsockopt(r->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(r->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  if (addr->sa.sa_family == AF_INET6) setsockopt(r->fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+  if (bind(r->fd, &addr->sa, sockaddr_len(addr)) < 0 || listen(r->fd, REFLECT_BACKLOG) < 0) goto fail;
+
+  r->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (r->epfd < 0) goto fail;
+  ev.events = EPOLLIN;
+  ev.data.fd = r->fd;
+  if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->fd, &ev) < 0) goto fail;
+  ev.data.fd = stop_fd;
+  if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, stop_fd, &ev) < 0) goto fail;
+  return 0;
+
+ fail:
+  saved = errno;
+  reflect_close(r);
+  errno = saved;
+  return -1;
+}
+
+/****************************************************
+ * take - Accept and close every queued connection  *
+ *                                                  *
+ * With stamp set the wall clock time of the accept *
+ * goes out first; a new socket always has room for *
+ * it.  Running out of descriptors leaves the       *
+ * handshake queued, so the thread waits a moment   *
+ * instead of spinning on it.                       *
+ ****************************************************/
+static void take(struct reflector *r) {
+  static const struct timespec pause = { 0, 1000000 };
+  uint8_t stamp[STAMP_LEN];
+  struct timespec wall;
+  uint64_t n = 0;
+  int fd;
+
+  while ((fd = accept4(r->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 || errno == ECONNABORTED || errno == EINTR) {
+    if (fd < 0) continue;
+    if (r->stamp) {
+      clock_gettime(CLOCK_REALTIME, &wall);
+      stamp_put(stamp, (int64_t)wall.tv_sec * NSEC_PER_SEC + wall.tv_nsec);
+      if (send(fd, stamp, sizeof(stamp), MSG_NOSIGNAL) != sizeof(stamp))
+        atomic_fetch_add_explicit(&r->failed, 1, memory_order_relaxed);
+    }
+    engine_hang_up(fd, r->closing);
+    n++;
+  }
+  atomic_fetch_add_explicit(&r->accepted, n, memory_order_relaxed);
+  if (errno != EAGAIN) {
+    atomic_fetch_add_explicit(&r->failed, 1, memory_order_relaxed);
+    nanosleep(&pause, NULL);
+  }
+}
+
+/***************************************************
+ * reflect_run - Thread body of one listener       *
+ *                                                 *
+ * Takes connections until stop_fd turns readable. *
+ ***************************************************/
+void *reflect_run(void *arg) {
+  struct reflector *r = arg;
+  struct epoll_event events[REFLECT_EVENTS];
+  cpu_set_t cpus;
+  int n, i;
+
+  if (r->cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(r->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+  for (;;) {
+    n = epoll_wait(r->epfd, events, REFLECT_EVENTS, -1);
+    for (i = 0; i < n; i++) {
+      if (events[i].data.fd == r->stop_fd) return NULL;
+      take(r);
+    }
+  }
+}
+
+/**************************************************
+ * reflect_close - Close a listener's descriptors *
+ **************************************************/
+void reflect_close(struct reflector *r) {
+  if (r->fd >= 0) close(r->fd);
+  if (r->epfd >= 0) close(r->epfd);
+  r->fd = r->epfd = -1;
+}
@@ -0,0 +1,44 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef REFLECT_H
+#define REFLECT_H
+
+#include <pthread.h>   // pthread_t
+#include <stdatomic.h> // atomic_uint_fast64_t
+#include "tcpping.h"
+#include "engine.h"
+
+#define REFLECT_BACKLOG 4096 // Handshakes the kernel may queue per listener
+#define REFLECT_EVENTS  16   // epoll events taken at once
+
+/******************************************************
+ * reflector - One thread of the --listen responder   *
+ *                                                    *
+ * Every reflector has its own SO_REUSEPORT socket on *
+ * the same address, so the kernel spreads incoming   *
+ * handshakes over the threads with no shared accept  *
+ * queue.  The counters are only written by the       *
+ * thread and read by the main thread for reports.    *
+ ******************************************************/
+struct reflector {
+  int fd;                 // Listening socket
+  int epfd;               // epoll set of fd and stop_fd
+  int stop_fd;            // Shared eventfd, readable when it is time to stop
+  int cpu;                // CPU the thread is pinned to, -1 if not pinned
+  close_mode closing;     // How accepted connections are closed
+  boolean stamp;          // Send the accept time before closing
+  pthread_t thread;
+  _Alignas(64) atomic_uint_fast64_t accepted; // Connections taken
+  atomic_uint_fast64_t failed; // accept() errors other than a dropped handshake
+};
+
+int reflect_open(struct reflector *r, const union sockaddr_any *addr, int stop_fd);
+void *reflect_run(void *arg);
+void reflect_close(struct reflector *r);
+
+#endif
@@ -0,0 +1,134 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdlib.h> // malloc
+#include "ring.h"
+
+#define RING_MASK (RING_SIZE - 1)
+
+/************************************************
+ * ring_init - Allocate an empty ring           *
+ *                                              *
+ * Returns 0 on success, -1 when out of memory. *
+ ************************************************/
+int ring_init(struct result_ring *r) {
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  r->tail_cache = 0;
+  r->head_cache = 0;
+  r->dropped = 0;
+  r->records = malloc(RING_SIZE * sizeof(struct probe_result));
+  return r->records ? 0 : -1;
+}
+
+/***********************
+ * ring_free - Free it *
+ ***********************/
+void ring_free(struct result_ring *r) {
+  free(r->records);
+  r->records = NULL;
+}
+
+/*****************************************************
+ * ring_push - Add a record (producer side)          *
+ *                                                   *
+ * Never waits: when the consumer has fallen a whole *
+ * ring behind the record is dropped and counted.    *
+ * Returns TRUE if the record was queued.            *
+ *****************************************************/
+boolean ring_push(struct result_ring *r, const struct probe_result *res) {
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  if (head - r->tail_cache == RING_SIZE) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - r->tail_cache == RING_SIZE) {
+      r->dropped++;
+      return FALSE;
+    }
+  }
+  r->records[head & RING_MASK] = *res;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return TRUE;
+}
+
+/*****************************************************
+ * ring_pop - Take the oldest record (consumer side) *
+ *                                                   *
+ * Returns FALSE when the ring is empty.             *
+ *****************************************************/
+boolean ring_pop(struct result_ring *r, struct probe_result *res) {
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  if (tail == r->head_cache) {
+    r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail == r->head_cache) return FALSE;
+  }
+  *res = r->records[tail & RING_MASK];
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return TRUE;
+}
+
+/***************************************************
+ * ring_empty - Whether the consumer has caught up *
+ *              (consumer side)                    *
+ ***************************************************/
+boolean ring_empty(struct result_ring *r) {
+  r->head_cache = atomic_load_explicit(&r->head, memory_order_seq_cst);
+  return atomic_load_explicit(&r->tail, memory_order_relaxed) == r->head_cache;
+}
+
+/*******************************************************
+ * update_init - Allocate an empty update ring holding *
+ *               at least min_size updates             *
+ *                                                     *
+ * Returns 0 on success, -1 when out of memory.        *
+ *******************************************************/
+int update_init(struct update_ring *r, int min_size) {
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  for (r->size = 16; r->size < (uint64_t)min_size; r->size *= 2);
+  r->records = malloc(r->size * sizeof(struct addr_update));
+  return r->records ? 0 : -1;
+}
+
+/*************************
+ * update_free - Free it *
+ *************************/
+void update_free(struct update_ring *r) {
+  free(r->records);
+  r->records = NULL;
+}
+
+/*****************************************************
+ * update_push - Add an update (producer side)       *
+ *                                                   *
+ * Returns FALSE, leaving the ring as it was, if the *
+ * shard has not taken the last ring's worth yet.    *
+ *****************************************************/
+boolean update_push(struct update_ring *r, const struct addr_update *up) {
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == r->size) return FALSE;
+  r->records[head & (r->size - 1)] = *up;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return TRUE;
+}
+
+/*******************************************************
+ * update_pop - Take the oldest update (consumer side) *
+ *                                                     *
+ * Returns FALSE when there is none, after a single    *
+ * load of a cache line that is almost never written.  *
+ *******************************************************/
+boolean update_pop(struct update_ring *r, struct addr_update *up) {
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  if (tail == atomic_load_explicit(&r->head, memory_order_acquire)) return FALSE;
+  *up = r->records[tail & (r->size - 1)];
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return TRUE;
+}
@@ -0,0 +1,74 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>    // uint64_t
+#include <stdatomic.h> // atomic_uint_fast64_t
+#include "tcpping.h"
+#include "engine.h"
+
+#define RING_SIZE (1 << 16) // Results a ring holds, a power of two
+
+/******************************************************
+ * result_ring - Single producer, single consumer     *
+ *               queue of finished probes             *
+ *                                                    *
+ * head is only written by the producer and tail only *
+ * by the consumer, each on its own cache line.  Both *
+ * sides keep a private copy of the other's index and *
+ * only reload it when the ring looks full or empty,  *
+ * so the cache lines rarely move between cores.      *
+ ******************************************************/
+struct result_ring {
+  _Alignas(64) atomic_uint_fast64_t head; // Next record to write
+  uint64_t tail_cache;                    // Producer's view of tail
+  _Alignas(64) atomic_uint_fast64_t tail; // Next record to read
+  uint64_t head_cache;                    // Consumer's view of head
+  _Alignas(64) struct probe_result *records; // RING_SIZE records
+  uint64_t dropped;                       // Pushes refused because the ring was full
+};
+
+/*************************************************
+ * addr_update - A target's new address, sent by *
+ *               the resolver to its shard       *
+ *************************************************/
+struct addr_update {
+  int target;                // Target moved
+  union sockaddr_any addr;   // Address to ping, port included
+  union sockaddr_any source; // Local address for SYN pings
+};
+
+/*****************************************************
+ * update_ring - Single producer, single consumer    *
+ *               queue of address updates            *
+ *                                                   *
+ * The main thread's resolver produces and a shard   *
+ * consumes before each turn of its loop.  Updates   *
+ * only come with TTLs running out, so unlike        *
+ * result_ring neither side caches the other's index *
+ * and the ring is sized to the shard's targets.     *
+ *****************************************************/
+struct update_ring {
+  _Alignas(64) atomic_uint_fast64_t head; // Next update to write
+  _Alignas(64) atomic_uint_fast64_t tail; // Next update to read
+  _Alignas(64) struct addr_update *records; // size records
+  uint64_t size;                          // A power of two
+};
+
+int ring_init(struct result_ring *r);
+void ring_free(struct result_ring *r);
+boolean ring_push(struct result_ring *r, const struct probe_result *res);
+boolean ring_pop(struct result_ring *r, struct probe_result *res);
+boolean ring_empty(struct result_ring *r);
+int update_init(struct update_ring *r, int min_size);
+void update_free(struct update_ring *r);
+boolean update_push(struct update_ring *r, const struct addr_update *up);
+boolean update_pop(struct update_ring *r, struct addr_update *up);
+
+#endif
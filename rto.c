@@ -0,0 +1,62 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include "rto.h"
+
+/****************************************
+ * clamp - Keep a timeout inside bounds *
+ ****************************************/
+static int64_t clamp(const struct rto *r, int64_t ns) {
+  if (ns < RTO_MIN_NS) ns = RTO_MIN_NS;
+  if (ns > r->max_ns) ns = r->max_ns;
+  return ns;
+}
+
+/*************************************************
+ * rto_init - Start an estimator with no samples *
+ *************************************************/
+void rto_init(struct rto *r, int64_t max_ns, double k) {
+  r->srtt_ns = 0;
+  r->rttvar_ns = 0;
+  r->rto_ns = max_ns;
+  r->max_ns = max_ns;
+  r->k = k;
+}
+
+/**************************************************
+ * rto_sample - Fold one measured rtt into the    *
+ *              estimate                          *
+ *                                                *
+ * The first sample sets SRTT = R, RTTVAR = R/2.  *
+ * After that RTTVAR moves 1/4 of the way towards *
+ * |SRTT - R| and SRTT 1/8 of the way towards R.  *
+ * The timeout is SRTT + k * RTTVAR.              *
+ **************************************************/
+void rto_sample(struct rto *r, int64_t rtt_ns) {
+  int64_t diff;
+
+  if (r->srtt_ns == 0) {
+    r->srtt_ns = rtt_ns;
+    r->rttvar_ns = rtt_ns / 2;
+  } else {
+    diff = r->srtt_ns - rtt_ns;
+    if (diff < 0) diff = -diff;
+    r->rttvar_ns += (diff - r->rttvar_ns) / 4;
+    r->srtt_ns += (rtt_ns - r->srtt_ns) / 8;
+  }
+  r->rto_ns = clamp(r, r->srtt_ns + (int64_t)(r->k * r->rttvar_ns));
+}
+
+/**************************************************
+ * rto_backoff - Double the timeout after a probe *
+ *               was lost                         *
+ *                                                *
+ * The next answer brings it straight back down.  *
+ **************************************************/
+void rto_backoff(struct rto *r) {
+  r->rto_ns = clamp(r, r->rto_ns * 2);
+}
@@ -0,0 +1,34 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef RTO_H
+#define RTO_H
+
+#include <stdint.h> // int64_t
+
+#define RTO_MIN_NS 10000000LL // Adaptive timeouts never go below 10 ms
+
+/****************************************************
+ * rto - Retransmission style timeout estimator     *
+ *                                                  *
+ * Smoothed rtt and rtt variation as in RFC 6298,   *
+ * kept in nanoseconds.  Until the first sample the *
+ * timeout is the configured maximum.               *
+ ****************************************************/
+struct rto {
+  int64_t srtt_ns;   // Smoothed rtt, 0 before the first sample
+  int64_t rttvar_ns; // Rtt variation
+  int64_t rto_ns;    // Timeout for the next probe
+  int64_t max_ns;    // Upper bound, the fixed timeout
+  double k;          // RTTVAR multiplier
+};
+
+void rto_init(struct rto *r, int64_t max_ns, double k);
+void rto_sample(struct rto *r, int64_t rtt_ns);
+void rto_backoff(struct rto *r);
+
+#endif
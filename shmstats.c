@@ -0,0 +1,232 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdio.h>    // snprintf
+#include <string.h>   // memcpy
+#include <unistd.h>   // ftruncate
+#include <fcntl.h>    // O_CREAT
+#include <errno.h>    // errno
+#include <signal.h>   // kill
+#include <sys/mman.h> // shm_open
+#include <sys/stat.h> // fstat
+#include "shmstats.h"
+
+// Statistics ahead of the histogram pointers, copied whole on every update
+#define STATS_LEN offsetof(struct ping_stats, hist)
+#define SHM_RETRIES 10000 // Torn reads of a slot before asking whether its writer is still there
+
+/**************************************************
+ * map_name - Segment name with its leading slash *
+ **************************************************/
+static void map_name(struct shm_stats *s, const char *name) {
+  snprintf(s->name, sizeof(s->name), "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+/****************************************
+ * shm_slot_of - Slot of one target     *
+ *                                      *
+ * Slots are slot_size apart, as the    *
+ * histograms they end with are counted *
+ * in the header.                       *
+ ****************************************/
+struct shm_slot *shm_slot_of(const struct shm_stats *s, int target) {
+  return (struct shm_slot *)(s->slots + (size_t)target * s->slot_size);
+}
+
+/**********************************************
+ * slot_hist - One of a slot's histograms,    *
+ *             NULL if the run has not got it *
+ **********************************************/
+static struct histogram *slot_hist(const struct shm_stats *s, struct shm_slot *slot, int which) {
+  return which < s->nhists ? &slot->hists[which] : NULL;
+}
+
+/***************************************************
+ * copy_bucket - Bring a published histogram up to *
+ *               date after one value was recorded *
+ ***************************************************/
+static void copy_bucket(struct histogram *to, const struct histogram *from, double ms) {
+  int b;
+
+  if (!to || !from) return;
+  b = hist_index((int64_t)(ms * 1000000));
+  to->total = from->total;
+  to->counts[b] = from->counts[b];
+}
+
+/*****************************************************
+ * shm_create - Create and map a segment for         *
+ *              ntargets targets                     *
+ *                                                   *
+ * Slots only carry a hello answer histogram with    *
+ * replies set.                                      *
+ * An existing segment of the same name is replaced. *
+ * Returns 0 on success, -1 with errno set on error. *
+ *****************************************************/
+int shm_create(struct shm_stats *s, const char *name, const char **labels, int ntargets, int64_t start_ns, boolean replies) {
+  void *map;
+  struct shm_slot *slot;
+  int fd, i, error;
+
+  memset(s, 0, sizeof(*s));
+  map_name(s, name);
+  s->nhists = replies ? SHM_REPLY + 1 : SHM_REPLY;
+  s->slot_size = sizeof(struct shm_slot) + s->nhists * sizeof(struct histogram);
+  s->size = sizeof(struct shm_header) + (size_t)ntargets * s->slot_size;
+  shm_unlink(s->name);
+  fd = shm_open(s->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) return -1;
+  if (ftruncate(fd, s->size) < 0 ||
+      (map = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    error = errno;
+    close(fd);
+    shm_unlink(s->name);
+    errno = error;
+    return -1;
+  }
+  close(fd);
+
+  // The segment starts out zeroed, so every seq is already even
+  s->header = map;
+  s->slots = (char *)(s->header + 1);
+  s->writing = 1;
+  for (i = 0; i < ntargets; i++) {
+    slot = shm_slot_of(s, i);
+    snprintf(slot->label, SHM_LABEL, "%s", labels[i]);
+    stats_init(&slot->stats, 0);
+  }
+  s->header->version = SHM_VERSION;
+  s->header->slot_size = s->slot_size;
+  s->header->ntargets = ntargets;
+  s->header->nhists = s->nhists;
+  s->header->pid = getpid();
+  s->header->start_ns = start_ns;
+  atomic_thread_fence(memory_order_release);
+  memcpy(s->header->magic, SHM_MAGIC, 8);
+  return 0;
+}
+
+/****************************************************
+ * shm_publish - Copy a target's statistics after a *
+ *               ping was recorded                  *
+ *                                                  *
+ * reason and ms are how the ping ended and how     *
+ * long it took, reply_ms the time its hello took   *
+ * to be answered, if it had one (else negative).   *
+ * Only the histogram buckets these landed in can   *
+ * have changed, so the 3.7 KB of buckets in each   *
+ * histogram are not copied.                        *
+ ****************************************************/
+void shm_publish(struct shm_stats *s, int target, const struct ping_stats *st, probe_reason reason, double ms, double reply_ms) {
+  struct shm_slot *slot = shm_slot_of(s, target);
+  unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(&slot->stats, st, STATS_LEN);
+  if (reason == REASON_OK) copy_bucket(slot_hist(s, slot, SHM_OK), st->hist, ms);
+  if (reason == REASON_REFUSED) copy_bucket(slot_hist(s, slot, SHM_REFUSED), st->refused_hist, ms);
+  if (reason == REASON_UNREACHABLE) copy_bucket(slot_hist(s, slot, SHM_UNREACHABLE), st->unreachable_hist, ms);
+  if (reply_ms >= 0) copy_bucket(slot_hist(s, slot, SHM_REPLY), st->reply_hist, reply_ms);
+  atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+/***************************************************
+ * shm_attach - Map an existing segment read only  *
+ *                                                 *
+ * Returns 0 on success, -1 with errno set; EINVAL *
+ * if it is not a segment from this version.       *
+ ***************************************************/
+int shm_attach(struct shm_stats *s, const char *name) {
+  struct stat st;
+  void *map;
+  int fd;
+
+  memset(s, 0, sizeof(*s));
+  map_name(s, name);
+  fd = shm_open(s->name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) < 0) st.st_size = 0;
+  map = MAP_FAILED;
+  if ((size_t)st.st_size >= sizeof(struct shm_header))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    errno = EINVAL;
+    return -1;
+  }
+  s->header = map;
+  s->slots = (char *)(s->header + 1);
+  s->size = st.st_size;
+  s->nhists = s->header->nhists;
+  s->slot_size = s->header->slot_size;
+  if (memcmp(s->header->magic, SHM_MAGIC, 8) != 0 || s->header->version != SHM_VERSION ||
+      s->header->nhists > SHM_HISTS ||
+      s->slot_size != sizeof(struct shm_slot) + s->header->nhists * sizeof(struct histogram) ||
+      s->size < sizeof(struct shm_header) + (size_t)s->header->ntargets * s->slot_size) {
+    shm_close(s);
+    errno = EINVAL;
+    return -1;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  return 0;
+}
+
+/***************************************************
+ * shm_snapshot - Consistent copy of one target's  *
+ *                statistics                       *
+ *                                                 *
+ * hists has room for SHM_HISTS histograms, which  *
+ * the copy's pointers then refer to; like a live  *
+ * target's they stay NULL while empty, and those  *
+ * are not copied.  Retries while the writer is    *
+ * mid-update, which only ever takes a few hundred *
+ * nanoseconds, but gives up after SHM_RETRIES.    *
+ * Returns 0 on success, -1 for a torn slot with   *
+ * errno ESRCH if the writer died mid-update, so   *
+ * it never will be whole, or EAGAIN if it is      *
+ * still there but stuck.                          *
+ ***************************************************/
+int shm_snapshot(const struct shm_stats *s, int target, struct ping_stats *st, struct histogram *hists) {
+  struct shm_slot *slot = shm_slot_of(s, target);
+  unsigned before, after;
+  int i, tries = 0;
+
+  do {
+    if (tries++ == SHM_RETRIES) {
+      errno = kill(s->header->pid, 0) < 0 && errno == ESRCH ? ESRCH : EAGAIN;
+      return -1;
+    }
+    before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    memcpy(st, &slot->stats, sizeof(*st));
+    for (i = 0; i < SHM_HISTS; i++) {
+      hists[i].total = i < s->nhists ? slot->hists[i].total : 0;
+      if (hists[i].total) memcpy(&hists[i], &slot->hists[i], sizeof(hists[i]));
+    }
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  } while ((before & 1) || before != after);
+  st->hist = hists[SHM_OK].total ? &hists[SHM_OK] : NULL;
+  st->refused_hist = hists[SHM_REFUSED].total ? &hists[SHM_REFUSED] : NULL;
+  st->unreachable_hist = hists[SHM_UNREACHABLE].total ? &hists[SHM_UNREACHABLE] : NULL;
+  st->reply_hist = hists[SHM_REPLY].total ? &hists[SHM_REPLY] : NULL;
+  return 0;
+}
+
+/*****************************************************
+ * shm_close - Unmap a segment                       *
+ *                                                   *
+ * The writer also removes its name, so readers that *
+ * still have it mapped keep the final numbers.      *
+ *****************************************************/
+void shm_close(struct shm_stats *s) {
+  if (s->header) munmap(s->header, s->size);
+  if (s->writing) shm_unlink(s->name);
+  s->header = NULL;
+  s->slots = NULL;
+  s->writing = 0;
+}
@@ -0,0 +1,79 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef SHMSTATS_H
+#define SHMSTATS_H
+
+#include <stdint.h>    // int64_t
+#include <stddef.h>    // size_t
+#include <stdatomic.h> // atomic_uint
+#include "stats.h"
+
+#define SHM_MAGIC   "TCPPSHM1"
+#define SHM_VERSION 6
+#define SHM_LABEL   320 // Bytes kept of a target's name
+
+// Histograms published after each slot's statistics, in this order
+#define SHM_OK          0 // Successful rtt
+#define SHM_REFUSED     1 // Time to a RST
+#define SHM_UNREACHABLE 2 // Time to an ICMP error
+#define SHM_REPLY       3 // Hello answer time, only in runs with a hello
+#define SHM_HISTS       4 // Most histograms a slot carries
+
+struct shm_header {
+  char magic[8];        // SHM_MAGIC
+  uint32_t version;     // SHM_VERSION
+  uint32_t slot_size;   // Bytes per slot, histograms included; guards against other builds
+  uint32_t ntargets;    // Slots following the header
+  uint32_t nhists;      // Histograms at the end of every slot
+  int32_t pid;          // Process publishing
+  int64_t start_ns;     // Wall clock the run started, ns since the epoch
+};
+
+/****************************************************
+ * shm_slot - Published statistics of one target    *
+ *                                                  *
+ * seq is a seqlock: odd while the writer is in the *
+ * middle of an update.  A reader copies the stats, *
+ * and keeps the copy only if seq was even and the  *
+ * same before and after.  The histograms a target  *
+ * only allocates when needed follow the stats,     *
+ * whose own pointers to them are left NULL; their  *
+ * pages are never touched, so cost no memory,      *
+ * unless the target has something to put in them.  *
+ ****************************************************/
+struct shm_slot {
+  atomic_uint seq;        // Update count times two, odd mid-update
+  char label[SHM_LABEL];  // Target name, fixed for the run
+  struct ping_stats stats; // Copy of the target's running statistics
+  struct histogram hists[]; // header->nhists of them, by SHM_OK and on
+};
+
+/****************************************************
+ * shm_stats - A mapped statistics segment          *
+ *                                                  *
+ * Created by a ping run with --shm, or opened read *
+ * only by --stats-from.                            *
+ ****************************************************/
+struct shm_stats {
+  char name[256];             // Segment name, unlinked by the writer on exit
+  struct shm_header *header;  // Start of the mapping
+  char *slots;                // One per target, slot_size bytes apart
+  size_t slot_size;           // Bytes per slot
+  int nhists;                 // Histograms per slot
+  size_t size;                // Bytes mapped
+  int writing;                // Created here rather than opened
+};
+
+int shm_create(struct shm_stats *s, const char *name, const char **labels, int ntargets, int64_t start_ns, boolean replies);
+void shm_publish(struct shm_stats *s, int target, const struct ping_stats *st, probe_reason reason, double ms, double reply_ms);
+int shm_attach(struct shm_stats *s, const char *name);
+struct shm_slot *shm_slot_of(const struct shm_stats *s, int target);
+int shm_snapshot(const struct shm_stats *s, int target, struct ping_stats *st, struct histogram *hists);
+void shm_close(struct shm_stats *s);
+
+#endif
@@ -0,0 +1,241 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include "stats.h"
+
+/************************************************
+ * stats_init - Reset statistics                *
+ *                                              *
+ * The first skip pings are not counted at all. *
+ ************************************************/
+void stats_init(struct ping_stats *st, int skip) {
+  memset(st, 0, sizeof(*st));
+  st->skip = skip;
+  st->prev_rtt = -1;
+}
+
+/*****************************************************
+ * stats_free - Release the histograms allocated on  *
+ *              first use                            *
+ *****************************************************/
+void stats_free(struct ping_stats *st) {
+  free(st->hist);
+  free(st->refused_hist);
+  free(st->unreachable_hist);
+  free(st->reply_hist);
+  st->hist = st->refused_hist = st->unreachable_hist = st->reply_hist = NULL;
+}
+
+/*****************************************************
+ * hist_needed - A histogram allocated on first use  *
+ *                                                   *
+ * Returns NULL if there is no memory for it, which  *
+ * only costs the percentiles of what it would hold. *
+ *****************************************************/
+static struct histogram *hist_needed(struct histogram **h) {
+  if (!*h && (*h = malloc(sizeof(struct histogram)))) hist_init(*h);
+  return *h;
+}
+
+/***************************************************
+ * stats_record - Add one ping to the statistics   *
+ *                                                 *
+ * Positive rtt is a success in milliseconds, zero *
+ * or negative is a failure.                       *
+ ***************************************************/
+void stats_record(struct ping_stats *st, double rtt) {
+  double diff;
+
+  if (st->skip) {
+    st->skip--;
+    return;
+  }
+  st->ping_count++;
+  if (rtt > 0) {
+    st->ping_success++;
+    st->stat_sum += rtt;  // Update sum stats
+    st->stat_count++;     // Update total recorded stats
+    if (hist_needed(&st->hist)) hist_record(st->hist, (int64_t)(rtt * 1000000));
+    if (st->prev_rtt == -1) { // Jitter staticistis
+      st->prev_rtt = rtt;
+    } else {
+      diff = st->prev_rtt - rtt;
+      if (diff < 0) diff = 0 - diff;
+      st->jitter_total += diff;
+      st->prev_rtt = rtt;
+      st->jitter_count++;
+    }
+    if (st->stat_count == 1) {
+      st->stat_min = st->stat_max = rtt;
+    }
+    if (rtt < st->stat_min) st->stat_min = rtt;
+    if (rtt > st->stat_max) st->stat_max = rtt;
+  } else {
+    st->ping_fail++;
+  }
+}
+
+/*****************************************************
+ * stats_record_failure - Add why a ping failed and  *
+ *                        how long that took         *
+ *                                                   *
+ * Must be called before stats_record() for the same *
+ * ping so skipped pings are left out here as well.  *
+ *****************************************************/
+void stats_record_failure(struct ping_stats *st, probe_reason reason, double ms) {
+  struct reason_stats *r;
+
+  if (st->skip || reason == REASON_OK || reason >= PROBE_REASONS) return;
+  r = &st->reasons[reason];
+  r->count++;
+  r->sum += ms;
+  if (r->count == 1) r->min = r->max = ms;
+  if (ms < r->min) r->min = ms;
+  if (ms > r->max) r->max = ms;
+  if (reason == REASON_REFUSED && hist_needed(&st->refused_hist))
+    hist_record(st->refused_hist, (int64_t)(ms * 1000000));
+  if (reason == REASON_UNREACHABLE && hist_needed(&st->unreachable_hist))
+    hist_record(st->unreachable_hist, (int64_t)(ms * 1000000));
+}
+
+/*****************************************************
+ * stats_record_kernel - Add the kernel's rtt for a  *
+ *                       successful ping             *
+ *                                                   *
+ * Must be called before stats_record() for the same *
+ * ping so skipped pings are left out here as well.  *
+ *****************************************************/
+void stats_record_kernel(struct ping_stats *st, double rtt, double kernel_rtt) {
+  if (st->skip) return;
+  st->kernel_count++;
+  st->kernel_sum += kernel_rtt;
+  st->overhead_sum += rtt - kernel_rtt;
+  if (st->kernel_count == 1) st->kernel_min = st->kernel_max = kernel_rtt;
+  if (kernel_rtt < st->kernel_min) st->kernel_min = kernel_rtt;
+  if (kernel_rtt > st->kernel_max) st->kernel_max = kernel_rtt;
+}
+
+/******************************************************
+ * stats_record_reply - Add how long a hello took to  *
+ *                      be answered                   *
+ *                                                    *
+ * The time runs from the end of the TCP handshake to *
+ * the ServerHello or first response byte.  Must be   *
+ * called before stats_record() for the same ping.    *
+ ******************************************************/
+void stats_record_reply(struct ping_stats *st, double ms) {
+  if (st->skip) return;
+  st->reply_count++;
+  st->reply_sum += ms;
+  if (st->reply_count == 1) st->reply_min = st->reply_max = ms;
+  if (ms < st->reply_min) st->reply_min = ms;
+  if (ms > st->reply_max) st->reply_max = ms;
+  if (hist_needed(&st->reply_hist)) hist_record(st->reply_hist, (int64_t)(ms * 1000000));
+}
+
+/*****************************************************
+ * stats_record_oneway - Add a reply split at the    *
+ *                       server's timestamp          *
+ *                                                   *
+ * Either half is off by the difference between the  *
+ * two hosts' clocks, so the minimums are the better *
+ * guide and a negative time just means the clocks   *
+ * disagree by more than the delay.                  *
+ *****************************************************/
+void stats_record_oneway(struct ping_stats *st, double forward, double reverse) {
+  if (st->skip) return;
+  st->oneway_count++;
+  st->forward_sum += forward;
+  st->reverse_sum += reverse;
+  if (st->oneway_count == 1 || forward < st->forward_min) st->forward_min = forward;
+  if (st->oneway_count == 1 || reverse < st->reverse_min) st->reverse_min = reverse;
+}
+
+/*****************************************
+ * stats_ave - Mean rtt of the successes *
+ *****************************************/
+double stats_ave(const struct ping_stats *st) {
+  return st->stat_count ? st->stat_sum / st->stat_count : 0;
+}
+
+/*******************************************
+ * stats_jitter - Mean absolute rtt change *
+ *******************************************/
+double stats_jitter(const struct ping_stats *st) {
+  return st->jitter_count ? st->jitter_total / st->jitter_count : 0;
+}
+
+/*******************************************
+ * stats_loss - Percentage of failed pings *
+ *******************************************/
+double stats_loss(const struct ping_stats *st) {
+  return st->ping_count ? (double)st->ping_fail / (double)st->ping_count * 100 : 0;
+}
+
+/*******************************************************
+ * stats_reason_hist - Histogram kept for a reason     *
+ *                                                     *
+ * Returns NULL for reasons that only keep min/ave/max *
+ * and before the first ping of the kind.              *
+ *******************************************************/
+const struct histogram *stats_reason_hist(const struct ping_stats *st, probe_reason reason) {
+  if (reason == REASON_OK) return st->hist;
+  if (reason == REASON_REFUSED) return st->refused_hist;
+  if (reason == REASON_UNREACHABLE) return st->unreachable_hist;
+  return NULL;
+}
+
+/******************************************************
+ * stats_reason_percentile - Percentile time to a     *
+ *                           failure                  *
+ *                                                    *
+ * Like stats_percentile(), for a reason that keeps a *
+ * histogram; otherwise 0.                            *
+ ******************************************************/
+double stats_reason_percentile(const struct ping_stats *st, probe_reason reason, double pct) {
+  const struct histogram *h = stats_reason_hist(st, reason);
+  const struct reason_stats *r = &st->reasons[reason];
+  double ms;
+
+  if (!h || reason == REASON_OK || r->count == 0) return 0;
+  ms = (double)hist_percentile(h, pct) / 1000000;
+  if (ms < r->min) ms = r->min;
+  if (ms > r->max) ms = r->max;
+  return ms;
+}
+
+/***********************************************
+ * stats_reply_percentile - Percentile time to *
+ *                          a hello's answer   *
+ ***********************************************/
+double stats_reply_percentile(const struct ping_stats *st, double pct) {
+  double ms;
+
+  if (st->reply_count == 0 || !st->reply_hist) return 0;
+  ms = (double)hist_percentile(st->reply_hist, pct) / 1000000;
+  if (ms < st->reply_min) ms = st->reply_min;
+  if (ms > st->reply_max) ms = st->reply_max;
+  return ms;
+}
+
+/******************************************************
+ * stats_percentile - Percentile rtt of the successes *
+ *                                                    *
+ * Read from the histogram and kept inside the exact  *
+ * min and max, so a single sample reports itself.    *
+ ******************************************************/
+double stats_percentile(const struct ping_stats *st, double pct) {
+  double rtt;
+
+  if (st->stat_count == 0 || !st->hist) return 0;
+  rtt = (double)hist_percentile(st->hist, pct) / 1000000;
+  if (rtt < st->stat_min) rtt = st->stat_min;
+  if (rtt > st->stat_max) rtt = st->stat_max;
+  return rtt;
+}
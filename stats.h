@@ -0,0 +1,81 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "hist.h"
+#include "tcpping.h"
+
+/*****************************************************
+ * reason_stats - Failures of one kind               *
+ *                                                   *
+ * Times are how long it took to learn of the        *
+ * failure, in milliseconds.  A RST or an ICMP error *
+ * is an answer from the network with a timing of    *
+ * its own, so those two also keep a histogram.      *
+ *****************************************************/
+struct reason_stats {
+  int count;             // Failures recorded
+  double sum, min, max;  // Time to failure
+};
+
+/******************************************************
+ * ping_stats - Running statistics for one target     *
+ *                                                    *
+ * RTT values are in milliseconds, a negative rtt is  *
+ * a failed ping.  Jitter is the mean absolute change *
+ * between consecutive successful pings.              *
+ * Every successful rtt also goes into a fixed size   *
+ * histogram for percentiles.  Failures are broken    *
+ * down by probe_reason.  The histograms are only     *
+ * allocated on the first value they would hold: the  *
+ * rtt one on the first success, so targets that      *
+ * never answer stay small, the failure time ones on  *
+ * the first failure of their kind, as most targets   *
+ * never have one, and the hello answer one on the    *
+ * first answer.                                      *
+ ******************************************************/
+struct ping_stats {
+  int skip;              // Pings left to ignore
+  int ping_count, ping_success, ping_fail;
+  int stat_count;        // Successful pings recorded
+  double stat_sum, stat_min, stat_max;
+  struct reason_stats reasons[PROBE_REASONS]; // Failures by reason, REASON_OK unused
+  double prev_rtt;       // Previous successful rtt, -1 before the first
+  double jitter_total;   // Sum of absolute rtt changes
+  int jitter_count;      // Number of rtt changes
+  int kernel_count;      // Pings with a kernel rtt
+  double kernel_sum, kernel_min, kernel_max;
+  double overhead_sum;   // Sum of user-space minus kernel rtt
+  int reply_count;       // Pings whose hello was answered
+  double reply_sum, reply_min, reply_max; // Connect to answer time
+  int oneway_count;      // Replies split by a server timestamp
+  double forward_sum, forward_min;  // Client to server share of the reply
+  double reverse_sum, reverse_min;  // Server to client share of the reply
+  struct histogram *hist;             // Successful rtt distribution, NULL before the first
+  struct histogram *refused_hist;     // Time to a RST, NULL before the first
+  struct histogram *unreachable_hist; // Time to an ICMP error, NULL before the first
+  struct histogram *reply_hist;       // Connect to answer time distribution, NULL before the first
+};
+
+void stats_init(struct ping_stats *st, int skip);
+void stats_free(struct ping_stats *st);
+void stats_record(struct ping_stats *st, double rtt);
+void stats_record_failure(struct ping_stats *st, probe_reason reason, double ms);
+void stats_record_kernel(struct ping_stats *st, double rtt, double kernel_rtt);
+void stats_record_reply(struct ping_stats *st, double ms);
+void stats_record_oneway(struct ping_stats *st, double forward, double reverse);
+double stats_ave(const struct ping_stats *st);
+double stats_jitter(const struct ping_stats *st);
+double stats_loss(const struct ping_stats *st);
+double stats_percentile(const struct ping_stats *st, double pct);
+const struct histogram *stats_reason_hist(const struct ping_stats *st, probe_reason reason);
+double stats_reason_percentile(const struct ping_stats *st, probe_reason reason, double pct);
+double stats_reply_percentile(const struct ping_stats *st, double pct);
+
+#endif
@@ -0,0 +1,460 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#define _GNU_SOURCE      // sendmmsg
+#include <stdio.h>       // FILE
+#include <stdlib.h>      // calloc
+#include <unistd.h>      // close
+#include <string.h>      // memset
+#include <errno.h>       // errno
+#include <sys/socket.h>  // socket
+#include <arpa/inet.h>   // htons
+#include <sys/random.h>  // getrandom
+#include <sys/mman.h>    // mmap
+#include <linux/if_packet.h> // TPACKET_V3
+#include <linux/if_ether.h>  // ETH_P_ALL
+#include <linux/filter.h>    // Classic BPF
+#include "syn.h"
+
+#define RING_BLOCK_SIZE (1 << 16) // Bytes per ring block
+#define RING_BLOCK_NR   64        // Blocks in the ring
+#define RING_FRAME_SIZE 2048      // Largest frame slot
+#define RING_SNAPLEN    128       // Bytes of each reply kept
+#define RING_RETIRE_MS  1         // Hand over partly filled blocks after this long
+
+/*************************************************
+ * checksum_add - Add 16 bit words to a checksum *
+ *************************************************/
+static uint32_t checksum_add(uint32_t sum, const void *data, int len) {
+  const uint8_t *p = data;
+  while (len > 1) {
+    sum += (p[0] << 8) | p[1];
+    p += 2;
+    len -= 2;
+  }
+  if (len) sum += p[0] << 8;
+  return sum;
+}
+
+/************************************************
+ * checksum_fold - Finish a ones complement sum *
+ ************************************************/
+static uint16_t checksum_fold(uint32_t sum) {
+  while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+  return htons(~sum & 0xffff);
+}
+
+/******************************************************
+ * reserve_range - Bind a run of consecutive ports    *
+ *                 between low and high               *
+ *                                                    *
+ * Tries random starting points until nports          *
+ * neighbouring ports are free.                       *
+ * Returns the first port, -1 if none could be found. *
+ ******************************************************/
+static int reserve_range(struct syn_socket *ss, int low, int high) {
+  union sockaddr_any addr;
+  uint16_t base;
+  int attempt, i, fd;
+
+  if (high - low + 1 < ss->nports) return -1;
+  // A dual stack IPv6 socket holds the port for both families
+  memset(&addr, 0, sizeof(addr));
+  addr.sa.sa_family = ss->fd6 >= 0 ? AF_INET6 : AF_INET;
+  for (attempt = 0; attempt < 32; attempt++) {
+    base = low + (ss->secret + attempt * 7919) % (high - low + 2 - ss->nports);
+    for (i = 0; i < ss->nports; i++) {
+      fd = socket(addr.sa.sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (addr.sa.sa_family == AF_INET6) addr.in6.sin6_port = htons(base + i);
+      else addr.in4.sin_port = htons(base + i);
+      if (fd < 0 || bind(fd, &addr.sa, sockaddr_len(&addr)) < 0) {
+        if (fd >= 0) close(fd);
+        break;
+      }
+      ss->port_fds[i] = fd;
+    }
+    if (i == ss->nports) return base;
+    while (i-- > 0) close(ss->port_fds[i]);
+  }
+  return -1;
+}
+
+/******************************************************
+ * reserve_ports - Find source ports for the SYNs     *
+ *                                                    *
+ * Ports above the ephemeral range are tried first:   *
+ * the kernel never hands them to outgoing            *
+ * connections, so they are not left blocked by       *
+ * TIME_WAIT entries on a busy host.                  *
+ * Returns the first port, -1 if none could be found. *
+ ******************************************************/
+static int reserve_ports(struct syn_socket *ss) {
+  FILE *file;
+  int low = 32768, high = 60999, base;
+
+  if ((file = fopen("/proc/sys/net/ipv4/ip_local_port_range", "r")) != NULL) {
+    if (fscanf(file, "%d %d", &low, &high) != 2) {
+      low = 32768;
+      high = 60999;
+    }
+    fclose(file);
+  }
+  if ((base = reserve_range(ss, high + 1, 65535)) >= 0) return base;
+  return reserve_range(ss, low, high);
+}
+
+/******************************************************
+ * syn_open - Open the raw sockets and source ports   *
+ *                                                    *
+ * The IPv6 raw socket is optional.                   *
+ * Returns 0 on success, -1 with errno set otherwise. *
+ * EPERM means the process lacks CAP_NET_RAW.         *
+ ******************************************************/
+int syn_open(struct syn_socket *ss, int nports) {
+  int base, i;
+
+  memset(ss, 0, sizeof(*ss));
+  ss->ring_fd = -1;
+  ss->fd6 = -1;
+  ss->fd = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+  if (ss->fd < 0) return -1;
+  ss->fd6 = socket(AF_INET6, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+
+  if (getrandom(&ss->secret, sizeof(ss->secret), 0) != sizeof(ss->secret))
+    ss->secret = (uint32_t)getpid() * 2654435761u;
+
+  ss->nports = nports;
+  ss->port_fds = calloc(nports, sizeof(int));
+  ss->frames = calloc(SYN_BATCH, SYN_LEN);
+  ss->iov = calloc(SYN_BATCH, sizeof(struct iovec));
+  ss->msgs = calloc(SYN_BATCH, sizeof(struct mmsghdr));
+  ss->dests = calloc(SYN_BATCH, sizeof(union sockaddr_any));
+  if (!ss->port_fds || !ss->frames || !ss->iov || !ss->msgs || !ss->dests) {
+    syn_close(ss);
+    errno = ENOMEM;
+    return -1;
+  }
+  for (i = 0; i < nports; i++) ss->port_fds[i] = -1;
+  if ((base = reserve_ports(ss)) < 0) {
+    syn_close(ss);
+    errno = EADDRINUSE;
+    return -1;
+  }
+  ss->port_base = base;
+
+  // Fill in everything about the batch that never changes
+  for (i = 0; i < SYN_BATCH; i++) {
+    ss->frames[i][12] = (SYN_LEN / 4) << 4;              // Data offset
+    ss->frames[i][13] = SYN_FLAG_SYN;
+    *(uint16_t *)(ss->frames[i] + 14) = htons(64240);    // Window
+    ss->frames[i][20] = 2;                               // MSS option
+    ss->frames[i][21] = 4;
+    *(uint16_t *)(ss->frames[i] + 22) = htons(1460);
+    ss->iov[i].iov_base = ss->frames[i];
+    ss->iov[i].iov_len = SYN_LEN;
+    ss->msgs[i].msg_hdr.msg_iov = &ss->iov[i];
+    ss->msgs[i].msg_hdr.msg_iovlen = 1;
+    ss->msgs[i].msg_hdr.msg_name = &ss->dests[i];
+  }
+  return 0;
+}
+
+/************************************************
+ * syn_close - Release the raw socket and ports *
+ ************************************************/
+void syn_close(struct syn_socket *ss) {
+  int i;
+  if (ss->port_fds) {
+    for (i = 0; i < ss->nports; i++)
+      if (ss->port_fds[i] >= 0) close(ss->port_fds[i]);
+    free(ss->port_fds);
+  }
+  if (ss->ring) munmap(ss->ring, ss->ring_len);
+  if (ss->ring_fd >= 0) close(ss->ring_fd);
+  if (ss->fd >= 0) close(ss->fd);
+  if (ss->fd6 >= 0) close(ss->fd6);
+  free(ss->frames);
+  free(ss->iov);
+  free(ss->msgs);
+  free(ss->dests);
+  ss->port_fds = NULL;
+  ss->frames = NULL;
+  ss->iov = NULL;
+  ss->msgs = NULL;
+  ss->dests = NULL;
+  ss->ring = NULL;
+  ss->ring_fd = -1;
+  ss->fd = -1;
+  ss->fd6 = -1;
+}
+
+/*******************************************************
+ * syn_route - Find the local address the kernel would *
+ *             use to reach dst                        *
+ *                                                     *
+ * Connecting a UDP socket sends nothing but picks the *
+ * route, so getsockname() shows the source address.   *
+ * Returns 0 on success, -1 on failure.                *
+ *******************************************************/
+int syn_route(const union sockaddr_any *dst, union sockaddr_any *src) {
+  socklen_t len = sizeof(*src);
+  int fd, status = -1;
+
+  fd = socket(dst->sa.sa_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, &dst->sa, sockaddr_len(dst)) == 0 &&
+      getsockname(fd, &src->sa, &len) == 0)
+    status = 0;
+  close(fd);
+  return status;
+}
+
+/******************************************************
+ * syn_queue - Add one SYN to the send batch          *
+ *                                                    *
+ * The kernel adds the IP header; only the ports,     *
+ * sequence number and checksum of the prebuilt TCP   *
+ * header are filled in here.  isn carries the probe  *
+ * id, which comes back as ack - 1 in either a        *
+ * SYN-ACK or a RST.  A batch holds one address       *
+ * family since each has its own raw socket.          *
+ * Returns the frame's position in the batch, or -1   *
+ * if the batch is full or holds the other family and *
+ * must be flushed first.                             *
+ ******************************************************/
+int syn_queue(struct syn_socket *ss, const union sockaddr_any *dst, const union sockaddr_any *src, uint16_t sport, uint32_t isn) {
+  int n = ss->queued;
+  uint8_t *tcp;
+  uint8_t pseudo[40];
+  uint32_t sum;
+
+  if (n == SYN_BATCH || (n && ss->family != dst->sa.sa_family)) return -1;
+  ss->family = dst->sa.sa_family;
+  ss->queued++;
+  tcp = ss->frames[n];
+
+  *(uint16_t *)(tcp + 0) = htons(sport);
+  *(uint16_t *)(tcp + 2) = htons(sockaddr_port(dst));
+  *(uint32_t *)(tcp + 4) = htonl(isn);
+  *(uint16_t *)(tcp + 16) = 0;
+
+  // Pseudo header: both addresses, then the protocol and TCP length
+  memset(pseudo, 0, sizeof(pseudo));
+  if (dst->sa.sa_family == AF_INET6) {
+    memcpy(pseudo, &src->in6.sin6_addr, 16);
+    memcpy(pseudo + 16, &dst->in6.sin6_addr, 16);
+    pseudo[35] = SYN_LEN;
+    pseudo[39] = IPPROTO_TCP;
+    sum = checksum_add(0, pseudo, 40);
+  } else {
+    memcpy(pseudo, &src->in4.sin_addr, 4);
+    memcpy(pseudo + 4, &dst->in4.sin_addr, 4);
+    pseudo[9] = IPPROTO_TCP;
+    pseudo[11] = SYN_LEN;
+    sum = checksum_add(0, pseudo, 12);
+  }
+  sum = checksum_add(sum, tcp, SYN_LEN);
+  *(uint16_t *)(tcp + 16) = checksum_fold(sum);
+
+  // An IPv6 raw socket reads sin6_port as the protocol, so leave it 0
+  ss->dests[n] = *dst;
+  if (dst->sa.sa_family == AF_INET6) ss->dests[n].in6.sin6_port = 0;
+  ss->msgs[n].msg_hdr.msg_namelen = sockaddr_len(dst);
+  return n;
+}
+
+/*****************************************************
+ * syn_flush - Send queued SYNs with one sendmmsg()  *
+ *                                                   *
+ * Starts at frame start of the batch.  The batch is *
+ * emptied once everything from start on went out.   *
+ * Returns how many frames from start were sent,     *
+ * which may be fewer than queued, or -1 with errno  *
+ * set when sendmmsg() itself failed.                *
+ *****************************************************/
+int syn_flush(struct syn_socket *ss, int start) {
+  int sent;
+
+  if (start >= ss->queued) {
+    ss->queued = 0;
+    return 0;
+  }
+  sent = sendmmsg(ss->family == AF_INET6 ? ss->fd6 : ss->fd, ss->msgs + start, ss->queued - start, 0);
+  if (sent < 0) return -1;
+  if (start + sent == ss->queued) ss->queued = 0;
+  return sent;
+}
+
+/*******************************************************
+ * syn_ring_open - Move reply reading to a packet ring *
+ *                                                     *
+ * Replies are read from a TPACKET_V3 ring mapped into *
+ * memory, so a whole block of them costs one wakeup.  *
+ * A classic BPF filter on the packet socket only lets *
+ * through incoming IPv4 and IPv6 TCP aimed at our     *
+ * source ports, and the raw sockets get a filter that *
+ * drops everything so their copy of all host TCP      *
+ * traffic is never queued.                            *
+ * Returns 0 on success, -1 with errno set otherwise.  *
+ *******************************************************/
+int syn_ring_open(struct syn_socket *ss) {
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 17, 0), // Our own traffic
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),                     // IP version
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 7),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 0, 12),     // Protocol
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 10, 0),         // Fragments
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),                     // X = IP header length
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),                      // Destination port
+    BPF_STMT(BPF_JMP | BPF_JA, 4),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 6),                // IPv6
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 0, 4),      // Next header, no extensions
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 42),                     // Destination port
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, ss->port_base, 0, 2),
+    BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, ss->port_base + ss->nports - 1, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, RING_SNAPLEN),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  struct sock_filter drop[] = { BPF_STMT(BPF_RET | BPF_K, 0) };
+  struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+  struct sock_fprog drop_prog = { 1, drop };
+  struct tpacket_req3 req;
+  struct sockaddr_ll ll;
+  int version = TPACKET_V3;
+
+  ss->ring_fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (ss->ring_fd < 0) return -1;
+
+  // Filter first so nothing unwanted lands in the ring before it is set up
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = RING_BLOCK_SIZE;
+  req.tp_block_nr = RING_BLOCK_NR;
+  req.tp_frame_size = RING_FRAME_SIZE;
+  req.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCK_NR;
+  req.tp_retire_blk_tov = RING_RETIRE_MS;
+  if (setsockopt(ss->ring_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0 ||
+      setsockopt(ss->ring_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+      setsockopt(ss->ring_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    goto fail;
+
+  ss->ring_len = (size_t)RING_BLOCK_SIZE * RING_BLOCK_NR;
+  ss->ring = mmap(NULL, ss->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, ss->ring_fd, 0);
+  if (ss->ring == MAP_FAILED)
+    ss->ring = mmap(NULL, ss->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, ss->ring_fd, 0);
+  if (ss->ring == MAP_FAILED) {
+    ss->ring = NULL;
+    goto fail;
+  }
+  ss->block_size = RING_BLOCK_SIZE;
+  ss->block_nr = RING_BLOCK_NR;
+  ss->block = 0;
+
+  memset(&ll, 0, sizeof(ll));
+  ll.sll_family = AF_PACKET;
+  ll.sll_protocol = htons(ETH_P_ALL);
+  ll.sll_ifindex = 0; // Every interface
+  if (bind(ss->ring_fd, (struct sockaddr *)&ll, sizeof(ll)) < 0) goto fail;
+
+  setsockopt(ss->fd, SOL_SOCKET, SO_ATTACH_FILTER, &drop_prog, sizeof(drop_prog));
+  if (ss->fd6 >= 0) setsockopt(ss->fd6, SOL_SOCKET, SO_ATTACH_FILTER, &drop_prog, sizeof(drop_prog));
+  return 0;
+
+ fail:
+  if (ss->ring) munmap(ss->ring, ss->ring_len);
+  close(ss->ring_fd);
+  ss->ring = NULL;
+  ss->ring_fd = -1;
+  return -1;
+}
+
+/*****************************************************
+ * syn_ring_read - Hand every packet in the finished *
+ *                 ring blocks to fn                 *
+ *                                                   *
+ * Each packet comes with the kernel's receive time  *
+ * on CLOCK_REALTIME.  Blocks are given back to the  *
+ * kernel as soon as they have been walked.          *
+ * Returns the number of packets seen.               *
+ *****************************************************/
+int syn_ring_read(struct syn_socket *ss, syn_packet_fn fn, void *ctx) {
+  struct tpacket_block_desc *desc;
+  struct tpacket3_hdr *hdr;
+  int seen = 0;
+  unsigned int i;
+
+  for (;;) {
+    desc = (struct tpacket_block_desc *)(ss->ring + (size_t)ss->block * ss->block_size);
+    if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) break;
+
+    hdr = (struct tpacket3_hdr *)((uint8_t *)desc + desc->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+      fn(ctx, (uint8_t *)hdr + hdr->tp_mac, hdr->tp_snaplen,
+         (int64_t)hdr->tp_sec * 1000000000LL + hdr->tp_nsec);
+      seen++;
+      hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+    }
+
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    ss->block = (ss->block + 1) % ss->block_nr;
+  }
+  return seen;
+}
+
+/*****************************************************
+ * syn_parse_tcp - Pick apart a TCP header           *
+ *                                                   *
+ * Returns 1 and fills in everything but the address *
+ * that answered for a SYN-ACK or RST to one of our  *
+ * source ports, 0 for anything else.                *
+ *****************************************************/
+int syn_parse_tcp(const struct syn_socket *ss, const uint8_t *tcp, int len, struct syn_reply *reply) {
+  uint16_t dport;
+
+  if (len < 20) return 0;
+  dport = ntohs(*(const uint16_t *)(tcp + 2));
+  if (dport < ss->port_base || dport >= ss->port_base + ss->nports) return 0;
+  reply->flags = tcp[13];
+  if (!(reply->flags & SYN_FLAG_RST) && (reply->flags & (SYN_FLAG_SYN | SYN_FLAG_ACK)) != (SYN_FLAG_SYN | SYN_FLAG_ACK))
+    return 0;
+
+  // sin_port and sin6_port share their offset
+  memset(&reply->from, 0, sizeof(reply->from));
+  reply->from.in4.sin_port = *(const uint16_t *)tcp;
+  reply->to_port = dport;
+  reply->ack = ntohl(*(const uint32_t *)(tcp + 8));
+  return 1;
+}
+
+/*****************************************************
+ * syn_parse - Pick apart an IPv4 or IPv6 packet     *
+ *                                                   *
+ * Packets from the ring and the IPv4 raw socket     *
+ * start with the IP header.                         *
+ * Returns 1 and fills reply for a SYN-ACK or RST to *
+ * one of our source ports, 0 for anything else.     *
+ *****************************************************/
+int syn_parse(const struct syn_socket *ss, const uint8_t *pkt, int len, struct syn_reply *reply) {
+  int ihl;
+
+  if (len >= 40 && (pkt[0] >> 4) == 6) {
+    if (pkt[6] != IPPROTO_TCP || !syn_parse_tcp(ss, pkt + 40, len - 40, reply)) return 0;
+    reply->from.in6.sin6_family = AF_INET6;
+    memcpy(&reply->from.in6.sin6_addr, pkt + 8, 16);
+    return 1;
+  }
+  if (len < 20 || (pkt[0] >> 4) != 4 || pkt[9] != IPPROTO_TCP) return 0;
+  ihl = (pkt[0] & 0x0f) * 4;
+  if (len < ihl + 20 || !syn_parse_tcp(ss, pkt + ihl, len - ihl, reply)) return 0;
+  reply->from.in4.sin_family = AF_INET;
+  memcpy(&reply->from.in4.sin_addr, pkt + 12, 4);
+  return 1;
+}
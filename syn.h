@@ -0,0 +1,75 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef SYN_H
+#define SYN_H
+
+#include <stdint.h>      // uint32_t
+#include <stddef.h>      // size_t
+#include <netinet/in.h>  // sockaddr_in
+#include <sys/uio.h>     // iovec
+#include "tcpping.h"
+
+#define SYN_LEN   24 // TCP header plus the MSS option
+#define SYN_BATCH 64 // SYNs handed to one sendmmsg() call
+
+/******************************************************
+ * syn_socket - Raw socket for half-open SYN probing  *
+ *                                                    *
+ * SYNs are written by hand and replies are read off  *
+ * the same raw socket.  The source ports are held by *
+ * bound but idle TCP sockets, so nothing else on the *
+ * host uses them and the kernel answers each SYN-ACK *
+ * with a RST, closing the half-open connection.      *
+ ******************************************************/
+struct syn_socket {
+  int fd;             // Raw IPPROTO_TCP socket
+  int fd6;            // Raw IPv6 IPPROTO_TCP socket, -1 if unavailable
+  int *port_fds;      // Sockets holding the source ports
+  int nports;         // Number of source ports
+  uint16_t port_base; // First source port (host order)
+  uint32_t secret;    // Mixed into every sequence number
+  // Send batch, allocated once in syn_open()
+  uint8_t (*frames)[SYN_LEN];  // Prebuilt SYN headers
+  struct iovec *iov;           // One per frame
+  struct mmsghdr *msgs;        // sendmmsg() vector
+  union sockaddr_any *dests;   // Destination of each frame
+  int queued;                  // Frames waiting to be sent
+  int family;                  // Address family of the queued frames
+  // Receive ring, see syn_ring_open()
+  int ring_fd;        // AF_PACKET socket, -1 when replies come off fd
+  uint8_t *ring;      // mmap()ed TPACKET_V3 blocks
+  size_t ring_len;    // Bytes mapped
+  int block_size;     // Bytes per block
+  int block_nr;       // Blocks in the ring
+  int block;          // Next block to look at
+};
+
+typedef void (*syn_packet_fn)(void *ctx, const uint8_t *pkt, int len, int64_t realtime_ns);
+
+struct syn_reply {
+  union sockaddr_any from; // Address and port that answered
+  uint16_t to_port;    // Our source port (host order)
+  uint32_t ack;        // Acknowledged sequence number
+  uint8_t flags;       // TCP flags
+};
+
+#define SYN_FLAG_RST 0x04
+#define SYN_FLAG_SYN 0x02
+#define SYN_FLAG_ACK 0x10
+
+int syn_open(struct syn_socket *ss, int nports);
+void syn_close(struct syn_socket *ss);
+int syn_route(const union sockaddr_any *dst, union sockaddr_any *src);
+int syn_queue(struct syn_socket *ss, const union sockaddr_any *dst, const union sockaddr_any *src, uint16_t sport, uint32_t isn);
+int syn_flush(struct syn_socket *ss, int start);
+int syn_ring_open(struct syn_socket *ss);
+int syn_ring_read(struct syn_socket *ss, syn_packet_fn fn, void *ctx);
+int syn_parse(const struct syn_socket *ss, const uint8_t *pkt, int len, struct syn_reply *reply);
+int syn_parse_tcp(const struct syn_socket *ss, const uint8_t *tcp, int len, struct syn_reply *reply);
+
+#endif
@@ -0,0 +1,275 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdio.h>     // FILE, printf
+#include <stdlib.h>    // realloc, strtol
+#include <string.h>    // strlen, memcpy
+#include <ctype.h>     // isspace
+#include <netdb.h>     // getaddrinfo()
+#include <arpa/inet.h> // inet_pton()
+#include "targets.h"
+
+/***************************************************
+ * targets_add - Append a host:port to the table   *
+ *                                                 *
+ * Returns the index of the new entry, -1 when out *
+ * of memory.                                      *
+ ***************************************************/
+int targets_add(struct target_table *tt, const char *host, int port) {
+  struct target *tg;
+  size_t len = strlen(host) + 1;
+  void *grown;
+  int size;
+
+  if (tt->count == tt->size) {
+    size = tt->size ? tt->size * 2 : 16;
+    grown = realloc(tt->targets, size * sizeof(struct target));
+    if (!grown) return -1;
+    tt->targets = grown;
+    tt->size = size;
+  }
+  if (tt->names_len + len > tt->names_size) {
+    size_t names_size = tt->names_size ? tt->names_size * 2 : 1024;
+    while (names_size < tt->names_len + len) names_size *= 2;
+    grown = realloc(tt->names, names_size);
+    if (!grown) return -1;
+    tt->names = grown;
+    tt->names_size = names_size;
+  }
+
+  tg = &tt->targets[tt->count];
+  memset(tg, 0, sizeof(*tg));
+  tg->name = tt->names_len;
+  tg->port = port;
+  memcpy(tt->names + tt->names_len, host, len);
+  tt->names_len += len;
+  return tt->count++;
+}
+
+/*******************************************
+ * target_name - Hostname of a table entry *
+ *******************************************/
+const char *target_name(const struct target_table *tt, int idx) {
+  return tt->names + tt->targets[idx].name;
+}
+
+/****************************************************
+ * parse_port - Convert a port string               *
+ *                                                  *
+ * Returns the port, or -1 if it is not 1 to 65535. *
+ ****************************************************/
+static int parse_port(const char *str) {
+  char *end;
+  long port;
+
+  if (!isdigit((unsigned char)*str)) return -1;
+  port = strtol(str, &end, 10);
+  if (*end != 0 || port < 1 || port > 65535) return -1;
+  return port;
+}
+
+/****************************************************
+ * targets_load - Read host:port lines from a file  *
+ *                                                  *
+ * Accepts "host:port", "host port" or just "host", *
+ * which uses default_port.  IPv6 addresses go in   *
+ * brackets, "[::1]:80", when they carry a port.    *
+ * Blank lines and lines starting with # are        *
+ * ignored.  A path of "-" reads standard input.    *
+ * Returns the number of targets added, -1 when the *
+ * file could not be read.                          *
+ ****************************************************/
+int targets_load(struct target_table *tt, const char *path, int default_port) {
+  FILE *file;
+  char line[512];
+  char *host, *port_str, *end;
+  int port, lineno = 0, added = 0;
+
+  if (strcmp(path, "-") == 0) file = stdin;
+  else file = fopen(path, "r");
+  if (!file) return -1;
+
+  while (fgets(line, sizeof(line), file)) {
+    lineno++;
+    // Trim leading and trailing white space
+    host = line;
+    while (isspace((unsigned char)*host)) host++;
+    end = host + strlen(host);
+    while (end > host && isspace((unsigned char)end[-1])) *--end = 0;
+    if (*host == 0 || *host == '#') continue;
+
+    // Split off the port
+    port_str = NULL;
+    for (end = host; *end && !isspace((unsigned char)*end); end++);
+    if (*end) {
+      *end++ = 0;
+      while (isspace((unsigned char)*end)) end++;
+      port_str = end;
+    } else if (*host != '[' && (end = strchr(host, ':')) != NULL && strchr(end + 1, ':') == NULL) {
+      *end++ = 0; // A bare IPv6 address has more than one colon
+      port_str = end;
+    }
+    if (*host == '[') {
+      if ((end = strchr(host, ']')) == NULL || (end[1] && (end[1] != ':' || port_str))) {
+        printf("%s:%d: Invalid target '%s'.\n", path, lineno, host);
+        continue;
+      }
+      if (end[1]) port_str = end + 2;
+      *end = 0;
+      host++;
+    }
+    port = port_str ? parse_port(port_str) : default_port;
+    if (port < 0 || *host == 0) {
+      printf("%s:%d: Invalid target '%s'.\n", path, lineno, host);
+      continue;
+    }
+    if (targets_add(tt, host, port) < 0) break;
+    added++;
+  }
+
+  if (file != stdin) fclose(file);
+  return added;
+}
+
+/*****************************************************
+ * system_lookup - Resolve a name with getaddrinfo() *
+ *                                                   *
+ * Returns the number of addresses stored in addrs.  *
+ *****************************************************/
+static int system_lookup(const char *name, int family, union sockaddr_any *addrs) {
+  struct addrinfo hints, *res, *ai;
+  int n = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_STREAM;
+  if (family == AF_UNSPEC) hints.ai_flags = AI_ADDRCONFIG;
+  if (getaddrinfo(name, NULL, &hints, &res) != 0) return 0;
+  for (ai = res; ai && n < DNS_MAX_ADDRS; ai = ai->ai_next) {
+    if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) continue;
+    memset(&addrs[n], 0, sizeof(addrs[n]));
+    memcpy(&addrs[n++], ai->ai_addr, ai->ai_addrlen);
+  }
+  freeaddrinfo(res);
+  return n;
+}
+
+/**************************************************
+ * literal_address - Parse a numeric IPv4 or IPv6 *
+ *                   address                      *
+ *                                                *
+ * Returns 1 if name is one, 0 otherwise.         *
+ **************************************************/
+static int literal_address(const char *name, union sockaddr_any *addr) {
+  memset(addr, 0, sizeof(*addr));
+  if (inet_pton(AF_INET, name, &addr->in4.sin_addr) == 1) addr->sa.sa_family = AF_INET;
+  else if (inet_pton(AF_INET6, name, &addr->in6.sin6_addr) == 1) addr->sa.sa_family = AF_INET6;
+  return addr->sa.sa_family != 0;
+}
+
+/******************************************************
+ * targets_resolve - Look up every target's address   *
+ *                                                    *
+ * All names are sent to the resolver at once and     *
+ * answered concurrently; whatever it cannot answer,  *
+ * such as a short name under a search domain, goes   *
+ * to getaddrinfo() instead.  Only the first address  *
+ * is kept, or with all every address becomes a       *
+ * target of its own sharing the hostname.  Targets   *
+ * are linked to their cache entry so they can follow *
+ * it when it is refreshed.  Entries that fail to     *
+ * resolve are reported and dropped.  With one        *
+ * address per name the table is compacted in place,  *
+ * so a large one is never held twice.                *
+ * Returns the number of targets left, -1 if out of   *
+ * memory.                                            *
+ ******************************************************/
+int targets_resolve(struct target_table *tt, struct dns_resolver *dns, boolean all) {
+  union sockaddr_any addrs[DNS_MAX_ADDRS];
+  struct dns_entry *entry;
+  struct target *out, *tg;
+  const char *name;
+  int i, j, n, kept = 0, size = tt->count, grow;
+  void *grown;
+
+  if (size == 0) return 0;
+  out = all ? malloc(size * sizeof(struct target)) : tt->targets;
+  if (!out) {
+    printf("Out of memory!\n");
+    return -1;
+  }
+
+  for (i = 0; i < tt->count; i++) {
+    tg = &tt->targets[i];
+    name = tt->names + tg->name;
+    tg->dns = literal_address(name, &addrs[0]) ? -1 : dns_resolve(dns, name);
+  }
+  dns_wait(dns);
+
+  for (i = 0; i < tt->count; i++) {
+    tg = &tt->targets[i];
+    name = tt->names + tg->name;
+    entry = tg->dns >= 0 ? &dns->entries[tg->dns] : NULL;
+    if (entry && entry->naddrs) {
+      n = entry->naddrs;
+      memcpy(addrs, entry->addrs, n * sizeof(addrs[0]));
+    } else if (literal_address(name, &addrs[0])) {
+      n = dns->family == AF_UNSPEC || dns->family == addrs[0].sa.sa_family;
+    } else {
+      n = system_lookup(name, dns->family, addrs);
+      tg->dns = -1;
+    }
+    if (n == 0) {
+      printf("Lookup for '%s' failed.\n", name);
+      continue;
+    }
+    if (!all) n = 1;
+
+    for (j = 0; j < n; j++) {
+      if (kept == size) {
+        grow = size * 2;
+        if ((grown = realloc(out, grow * sizeof(struct target))) == NULL) {
+          free(out);
+          printf("Out of memory!\n");
+          return -1;
+        }
+        out = grown;
+        size = grow;
+      }
+      out[kept] = *tg;
+      out[kept].addr = addrs[j];
+      if (addrs[j].sa.sa_family == AF_INET6) out[kept].addr.in6.sin6_port = htons(tg->port);
+      else out[kept].addr.in4.sin_port = htons(tg->port);
+      out[kept].multi = n > 1;
+      out[kept].dns_next = -1;
+      if (tg->dns >= 0) {
+        out[kept].dns_next = dns->entries[tg->dns].targets;
+        dns->entries[tg->dns].targets = kept;
+        dns->entries[tg->dns].current = addrs[0];
+      }
+      kept++;
+    }
+  }
+
+  if (out != tt->targets) free(tt->targets);
+  tt->targets = out;
+  tt->count = kept;
+  tt->size = all ? size : tt->size;
+  return kept;
+}
+
+/**********************************
+ * targets_free - Release a table *
+ **********************************/
+void targets_free(struct target_table *tt) {
+  int i;
+
+  for (i = 0; i < tt->count; i++) stats_free(&tt->targets[i].stats);
+  free(tt->targets);
+  free(tt->names);
+  memset(tt, 0, sizeof(*tt));
+}
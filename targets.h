@@ -0,0 +1,54 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef TARGETS_H
+#define TARGETS_H
+
+#include <stdint.h>      // int64_t
+#include <stddef.h>      // size_t
+#include <netinet/in.h>  // sockaddr_in
+#include "tcpping.h"
+#include "stats.h"
+#include "dns.h"
+#include "rto.h"
+
+/*****************************************************
+ * target - One host:port being pinged               *
+ *                                                   *
+ * Hostnames are kept in a shared arena and referred *
+ * to by offset so each entry stays small.           *
+ *****************************************************/
+struct target {
+  uint32_t name;           // Offset of the hostname in the name arena
+  uint16_t port;           // TCP port (host order)
+  union sockaddr_any addr; // Resolved address, IPv4 or IPv6
+  union sockaddr_any source; // Local address for SYN pings
+  boolean multi;           // One of several addresses of its name
+  int dns;                 // Resolver cache entry, -1 if not re-resolved
+  int dns_next;            // Next target on the same cache entry, -1 at the end
+  int sent;                // Pings sent so far
+  int64_t next_send_ns;    // When the next ping is due
+  struct ping_stats stats; // Statistics for this target
+  struct rto rto;          // Timeout estimator, fixed at -t unless adaptive
+};
+
+struct target_table {
+  struct target *targets;  // Target entries
+  int count;               // Entries in use
+  int size;                // Entries allocated
+  char *names;             // NUL separated hostnames
+  size_t names_len;        // Bytes of the arena in use
+  size_t names_size;       // Bytes of the arena allocated
+};
+
+int targets_add(struct target_table *tt, const char *host, int port);
+int targets_load(struct target_table *tt, const char *path, int default_port);
+int targets_resolve(struct target_table *tt, struct dns_resolver *dns, boolean all);
+const char *target_name(const struct target_table *tt, int idx);
+void targets_free(struct target_table *tt);
+
+#endif
@@ -5,113 +5,520 @@
  *          https://www.gnu.org/licenses/gpl-3.0.en.html *
  *********************************************************/
 
+#define _GNU_SOURCE    // CPU affinity
 #include <time.h>      // Clock
 #include <stdio.h>     // printf
 #include <stdlib.h>    // exit
 #include <unistd.h>    // sleep
 #include <ctype.h>     // isdigit
-#include <arpa/inet.h> // inet_addr()
-#include <netdb.h>     // hostent, gethostbyname()
+#include <arpa/inet.h> // inet_ntop()
+#include <sys/socket.h> // AF_INET6
 #include <string.h>    // strncpy
 #include <errno.h>     // errno
-#include <fcntl.h>     // Non-blocking
 #include <signal.h>    // Handle SIGINT, SIGTERM
+#include "tcpping.h"
+#include "engine.h"
+#include "stats.h"
+#include "targets.h"
+#include "dns.h"
+#include "wheel.h"
+#include "out.h"
+#include "probelog.h"
+#include "metrics.h"
+#include "shmstats.h"
+#include "ring.h"
+#include "hello.h"
+#include "reflect.h"
+#include "calib.h"
+#include <sys/resource.h> // getrlimit
+#include <sys/eventfd.h> // eventfd
+#include <pthread.h>      // Worker threads
+#include <sched.h>        // CPU affinity
+#include <sys/mman.h>     // mlockall
+#include <stdatomic.h>    // Waking the output thread
 
 /*************************
  * Globals and Constants *
  *************************/
 const char version[] = "1.0.8";
-typedef enum {FALSE = 0, TRUE = 1} boolean;
-const int LEN = 256;   // Maximum hostname size
-int timeout = 3;       // Seconds before timeout
-int terminate = FALSE; // SIGTERM, SIGINT triggered
+#define LEN 256        // Maximum hostname size
+#define LABEL_LEN (LEN + INET6_ADDRSTRLEN + 16) // Hostname, address and port
+#define JSON_FIELDS 512 // JSON Lines record bytes besides the target and address
+#define SYN_PORTS 64   // Source ports used by SYN pings
+#define SYN_SLOTS (1 << 24) // SYN ping ids available
+#define AUTO_SLOTS (1 << 18) // Most pings in flight per worker unless -m asks for more
+#define MAX_SHARDS 256 // Most worker threads allowed
+double timeout = 3;    // Seconds before timeout
+volatile sig_atomic_t terminate = FALSE; // SIGTERM, SIGINT triggered
 
-/*********************************************
- * tcp_ping - Single tcp ping to ipaddr:port *
- *                                           *
- * Returns the RTT in milliseconds.          *
- * Returns -1 on timeout.                    *
- * Returns -2 on failure connecting.         * 
- *********************************************/
-double tcp_ping(char *ipaddr, int port) {
-  int sock;
-  long arg;
-  double rtt, diff_sec, diff_nsec;
-  struct sockaddr_in address;
-  struct timespec timestamp1, timestamp2;
-  fd_set fdset;
-  struct timeval tv; // Time value for timeout checks
-  int status;
-  int optval;
-  socklen_t optlen;
-  
-  // socket create and verification
-  sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock == -1) {
-    printf("Socket creation failed!\n");
-    exit(0);
+/***************
+ * Run options *
+ ***************/
+boolean audible = FALSE; // Audible ping
+int display = 0;         // 0 = All pings and stats, 1 = stats only, 2 = clean, 3 = jsonl
+struct target_table table; // Everything being pinged
+struct dns_resolver resolver; // Name lookups and their cache
+double percentiles[16] = {50, 90, 99, 99.9}; // Percentiles in the summary
+int percentile_count = 4;
+double adaptive = 0;     // RTTVAR multiplier of adaptive timeouts, 0 = fixed timeout
+struct out_buffer out = { .fd = -1, .flush_ns = INT64_MAX }; // JSON Lines records waiting to be written
+char **json_targets;     // Preformatted target and address fields of each record
+union sockaddr_any *json_addrs; // Address each json_targets entry was made for
+int64_t wall_offset_ns;  // CLOCK_REALTIME minus the raw clock
+struct probe_log plog = { .fd = -1 }; // --log file, mapped while open
+struct metrics_server metrics = { .listen_fd = -1, .epfd = -1 }; // --metrics exporter
+struct shm_stats shm;    // --shm statistics segment, mapped while open
+int count = 0;           // Pings per target, 0 = unlimited
+int64_t interval_ns;     // Time between the pings of a target
+int64_t timeout_ns;      // Longest a ping may take
+int64_t no_port;         // Pings that found no free local port (EADDRNOTAVAIL)
+hello_mode hello = HELLO_NONE; // --hello sent after connecting
+struct calibration calib; // --calibrate results
+int64_t subtract_ns;     // --subtract, taken off every successful rtt
+int64_t error_ns = -1;   // Error bound shown with each rtt, -1 if not calibrated
+
+/****************************************************
+ * shard - One probing loop and the targets it owns *
+ *                                                  *
+ * Target i belongs to shard i % nshards, and only  *
+ * that shard's thread touches its schedule and     *
+ * address, so the loops share nothing while they   *
+ * run.  Finished pings go through the shard's ring *
+ * to the main thread, which owns the statistics    *
+ * and every output.                                *
+ ****************************************************/
+struct shard {
+  int id;                  // Index, also its first target
+  pthread_t thread;        // Worker thread
+  int cpu;                 // CPU the thread is pinned to, -1 if not pinned
+  struct engine eng;       // Probe engine of the shard
+  struct wheel schedule;   // Next send time of each target, by i / nshards
+  int ntargets;            // Targets owned
+  int64_t remaining;       // Pings left to send
+  int64_t missed;          // Turns skipped because the loop fell behind
+  struct result_ring results; // Finished pings on their way to the main thread
+  struct update_ring updates; // New target addresses from the resolver
+};
+struct shard *shards;    // All shards
+int nshards = 1;         // Worker threads
+int stop_fd = -1;        // eventfd that wakes the workers up to stop
+int done_fd = -1;        // eventfd each worker bumps as it finishes
+int wake_fd = -1;        // eventfd that wakes the main thread up for results
+atomic_int output_sleeping; // Main thread is waiting with every ring empty
+
+/**************************************************
+ * address_string - Numeric form of an IPv4 or v6 *
+ *                  address                       *
+ **************************************************/
+const char *address_string(const union sockaddr_any *addr, char *buf, socklen_t size) {
+  if (addr->sa.sa_family == AF_INET6) return inet_ntop(AF_INET6, &addr->in6.sin6_addr, buf, size);
+  return inet_ntop(AF_INET, &addr->in4.sin_addr, buf, size);
+}
+
+/*****************************************************
+ * target_label - Name a target among several        *
+ *                                                   *
+ * Shows host:port, with IPv6 addresses in brackets. *
+ * A name probed on all of its addresses also shows  *
+ * the address, as host (address):port.              *
+ *****************************************************/
+void target_label(int idx, char *buf, size_t size) {
+  struct target *tg = &table.targets[idx];
+  const char *name = target_name(&table, idx);
+  char addr[INET6_ADDRSTRLEN];
+
+  if (tg->multi)
+    snprintf(buf, size, "%s (%s):%d", name, address_string(&tg->addr, addr, sizeof(addr)), tg->port);
+  else if (strchr(name, ':'))
+    snprintf(buf, size, "[%s]:%d", name, tg->port);
+  else
+    snprintf(buf, size, "%s:%d", name, tg->port);
+}
+
+/****************************************************
+ * summary_name - Name a target in summaries, logs  *
+ *                and metrics                       *
+ *                                                  *
+ * A lone target goes by its hostname, as it always *
+ * has; with several, each gets its full label.     *
+ ****************************************************/
+void summary_name(int idx, char *buf, size_t size) {
+  if (table.count == 1) snprintf(buf, size, "%s", target_name(&table, idx));
+  else target_label(idx, buf, size);
+}
+
+/****************************************************
+ * json_target - Preformat the target fields of a   *
+ *               JSON Lines record                  *
+ *                                                  *
+ * Done once per target, and again when its address *
+ * changes, so a record only has numbers to format. *
+ * The label is escaped in full; even one made of   *
+ * nothing but control characters leaves the record *
+ * within OUT_RECORD.                               *
+ ****************************************************/
+_Static_assert(OUT_JSON(LABEL_LEN) + OUT_JSON(INET6_ADDRSTRLEN) + JSON_FIELDS <= OUT_RECORD,
+               "a JSON Lines record has to fit in OUT_RECORD");
+
+void json_target(int idx, const union sockaddr_any *where) {
+  char label[LABEL_LEN], addr[INET6_ADDRSTRLEN];
+  char scratch[OUT_JSON(LABEL_LEN) + OUT_JSON(INET6_ADDRSTRLEN) + 32];
+  struct out_buffer ob = { .buf = scratch };
+
+  target_label(idx, label, sizeof(label));
+  out_str(&ob, "\"target\":");
+  out_json(&ob, label);
+  out_str(&ob, ",\"addr\":");
+  out_json(&ob, address_string(where, addr, sizeof(addr)));
+  out_str(&ob, ",");
+  scratch[ob.len] = 0;
+  free(json_targets[idx]);
+  json_targets[idx] = strdup(scratch);
+  json_addrs[idx] = *where;
+}
+
+
+/**************************************************
+ * json_result - Queue one JSON Lines record      *
+ *                                                *
+ * ts is the wall clock time the SYN went out, in *
+ * nanoseconds since the epoch.  rtt_ns is also   *
+ * given for errors, as the time until the error  *
+ * was known.                                     *
+ **************************************************/
+void json_result(const struct probe_result *res) {
+  static const char *outcomes[] = { "ok", "timeout", "error" };
+
+  // The target may have moved to a new address since the last record
+  if (memcmp(&json_addrs[res->target], &res->addr, sizeof(res->addr)) != 0)
+    json_target(res->target, &res->addr);
+  out_str(&out, "{\"ts\":");
+  out_int(&out, res->sent_ns + wall_offset_ns);
+  out_str(&out, ",");
+  out_str(&out, json_targets[res->target]);
+  out_str(&out, "\"seq\":");
+  out_int(&out, res->seq);
+  out_str(&out, ",\"outcome\":\"");
+  out_str(&out, outcomes[res->outcome]);
+  out_str(&out, "\",\"rtt_ns\":");
+  if (res->outcome != PROBE_TIMEOUT) out_int(&out, res->rtt_ns);
+  else out_str(&out, "null");
+  if (res->kernel_rtt_ns >= 0) {
+    out_str(&out, ",\"kernel_rtt_ns\":");
+    out_int(&out, res->kernel_rtt_ns);
+  }
+  if (res->reply_ns >= 0) {
+    out_str(&out, ",\"");
+    out_str(&out, hello_name(hello));
+    out_str(&out, "_ns\":");
+    out_int(&out, res->reply_ns);
+  }
+  if (hello == HELLO_STAMP && res->reply_ns >= 0) {
+    out_str(&out, ",\"fwd_ns\":");
+    out_int(&out, res->forward_ns);
+    out_str(&out, ",\"rev_ns\":");
+    out_int(&out, res->reverse_ns);
+  }
+  if (res->outcome == PROBE_OK && error_ns >= 0) {
+    out_str(&out, ",\"err_ns\":");
+    out_int(&out, error_ns);
+  }
+  if (res->outcome == PROBE_TIMEOUT) {
+    out_str(&out, ",\"timeout_ns\":");
+    out_int(&out, res->timeout_ns);
   }
+  out_str(&out, ",\"errno\":");
+  out_int(&out, res->error);
+  out_str(&out, ",\"class\":\"");
+  out_str(&out, res->reason == REASON_OK ? "none" : probe_reason_name(res->reason));
+  out_str(&out, "\"}\n");
+  out_end(&out, res->sent_ns + res->rtt_ns);
+}
 
-  // Set socket as non-blocking
-  arg = fcntl(sock, F_GETFL, NULL); // Get current args
-  arg |= O_NONBLOCK;                // Add the non-blocking option
-  fcntl(sock, F_SETFL, arg);
-  
-  // Set timeout
-  tv.tv_sec = timeout;
-  tv.tv_usec = 0;
-
-  // Set packet information
-  address.sin_family = AF_INET;
-  address.sin_addr.s_addr = inet_addr(ipaddr);
-  address.sin_port = htons(port);
-
-  // Read clock before sending/connecting
-  clock_gettime(CLOCK_MONOTONIC_RAW, &timestamp1);
-
-  // Connect the client socket to server socket
-  status = connect(sock, (struct sockaddr *)&address, sizeof(address));
-
-  // Should be a negative status unless the tcp handshake is really fast. :)
-  if (status < 0) {
-     if (errno == EINPROGRESS) {
-        do {
-           FD_ZERO(&fdset);
-           FD_SET(sock, &fdset);
-           status = select(sock+1, NULL, &fdset, NULL, &tv);
-           if (status < 0 && errno != EINTR) {
-	     // Error connecting
-             return -2;
-           } else if (status > 0) {
-	     // Connected
-	     optlen = sizeof(int);
-	     getsockopt(sock, SOL_SOCKET, SO_ERROR, (void*)(&optval), &optlen);
-	     break;
-           } else {
-	     // Timeout
-	     return -1;
-           }
-        } while (1);
-     } else {
-       // Failure to connect
-       return -2;
-     }
-  }
-
-  // Read clock after sending/connecting (after SYN and ACK)
-  clock_gettime(CLOCK_MONOTONIC_RAW, &timestamp2);
-
-  // Close the connection
-  close(sock);
-
-  // Calculate elapsed time
-  diff_sec = timestamp2.tv_sec - timestamp1.tv_sec;
-  diff_nsec = timestamp2.tv_nsec - timestamp1.tv_nsec;
-  rtt = diff_sec * 1000;
-  rtt += diff_nsec / 1000000;
-
-  // Return elapsed time
-  return rtt;
+/****************************************************
+ * on_result - Hand a finished ping to the main     *
+ *             thread                               *
+ *                                                  *
+ * Called by the engine for every probe that either *
+ * completed its handshake, failed or timed out.    *
+ * Only the adaptive timeout, which the next ping   *
+ * of the target needs, is updated here; the rest   *
+ * waits in the shard's ring for record_result().   *
+ * A full ring drops the result rather than holding *
+ * up the pings.                                    *
+ ****************************************************/
+void on_result(struct engine *eng, const struct probe_result *res, void *ctx) {
+  struct shard *sh = ctx;
+  struct target *tg = &table.targets[res->target];
+  uint64_t one = 1;
+
+  // Adapt the target's timeout, which covers a hello's answer as well as the handshake
+  if (adaptive && res->outcome == PROBE_OK) rto_sample(&tg->rto, res->rtt_ns + (res->reply_ns > 0 ? res->reply_ns : 0));
+  if (adaptive && res->outcome == PROBE_TIMEOUT) rto_backoff(&tg->rto);
+
+  if (!ring_push(&sh->results, res)) return;
+  // Pairs with the main thread setting output_sleeping before its last look at the rings
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&output_sleeping, memory_order_relaxed) && atomic_exchange(&output_sleeping, 0))
+    if (write(wake_fd, &one, sizeof(one)) < 0) terminate = TRUE;
+}
+
+/****************************************************
+ * record_result - Display and record a finished    *
+ *                 ping                             *
+ *                                                  *
+ * Runs on the main thread, in the order each shard *
+ * finished its pings.                              *
+ ****************************************************/
+void record_result(const struct probe_result *res) {
+  struct target *tg = &table.targets[res->target];
+  struct probe_result adjusted; // res less the calibrated floor
+  char label[LABEL_LEN]; // Target as shown on each line
+  char kernel[128] = ""; // Kernel rtt and hello reply shown next to ours
+  char what[96];         // Kind of failure shown
+  double ms;             // Time to the outcome, failures included
+  int skip = tg->stats.skip;
+  double rtt;
+
+  // A success stays a success, however close to the floor it came in
+  if (subtract_ns && res->outcome == PROBE_OK) {
+    adjusted = *res;
+    adjusted.rtt_ns = res->rtt_ns > subtract_ns ? res->rtt_ns - subtract_ns : 1;
+    res = &adjusted;
+  }
+  ms = (double)res->rtt_ns / NSEC_PER_MSEC;
+  if (res->outcome == PROBE_OK) rtt = (double)res->rtt_ns / NSEC_PER_MSEC;
+  else if (res->outcome == PROBE_TIMEOUT) rtt = -1;
+  else rtt = -2;
+
+  // Display audible bell (if requested)
+  if (audible && display != 3) printf("\a");
+
+  // Display RTT latency
+  if (display == 0) {
+    if (table.count == 1) address_string(&res->addr, label, sizeof(label));
+    else target_label(res->target, label, sizeof(label));
+    if (rtt > 0) {
+      if (res->kernel_rtt_ns >= 0)
+        snprintf(kernel, sizeof(kernel), " kernel=%0.3f ms", (double)res->kernel_rtt_ns / NSEC_PER_MSEC);
+      if (res->reply_ns >= 0)
+        snprintf(kernel + strlen(kernel), sizeof(kernel) - strlen(kernel), " %s=%0.3f ms",
+                 hello_name(hello), (double)res->reply_ns / NSEC_PER_MSEC);
+      if (hello == HELLO_STAMP && res->reply_ns >= 0)
+        snprintf(kernel + strlen(kernel), sizeof(kernel) - strlen(kernel), " fwd=%0.3f ms rev=%0.3f ms",
+                 (double)res->forward_ns / NSEC_PER_MSEC, (double)res->reverse_ns / NSEC_PER_MSEC);
+      if (error_ns >= 0)
+        snprintf(kernel + strlen(kernel), sizeof(kernel) - strlen(kernel), " err=%0.3f ms", (double)error_ns / NSEC_PER_MSEC);
+      if (skip) printf("%s: seq=%d time=%0.3f ms%s (skip: %d)\n", label, res->seq, rtt, kernel, skip);
+      else printf("%s: seq=%d time=%0.3f ms%s\n", label, res->seq, rtt, kernel);
+    } else {
+      if (rtt == -1) {
+        if (skip) printf("%s: seq=%d timeout(%g) (skip: %d)\n", label, res->seq, (double)res->timeout_ns / NSEC_PER_SEC, skip);
+        else printf("%s: seq=%d timeout(%g)\n", label, res->seq, (double)res->timeout_ns / NSEC_PER_SEC);
+      }
+      if (rtt == -2) {
+        if (res->reason == REASON_REFUSED) snprintf(what, sizeof(what), "connection refused");
+        else if (res->reason == REASON_UNREACHABLE) snprintf(what, sizeof(what), "unreachable");
+        else snprintf(what, sizeof(what), "%s error: %s", res->reason == REASON_LOCAL ? "local" : "connection", strerror(res->error));
+        if (skip) printf("%s: seq=%d %s time=%0.3f ms (skip: %d)\n", label, res->seq, what, ms, skip);
+        else printf("%s: seq=%d %s time=%0.3f ms\n", label, res->seq, what, ms);
+      }
+    }
+    fflush(stdout);
+  }
+  if (res->outcome == PROBE_ERROR && res->error == EADDRNOTAVAIL) no_port++;
+  if (display == 3) json_result(res);
+  if (plog.map) plog_append(&plog, res->target, res->sent_ns + wall_offset_ns, res->rtt_ns, res->reason);
+  if (metrics.targets) metrics_record(&metrics, res->target, res->reason, res->rtt_ns);
+
+  // Update statistics
+  if (rtt > 0 && res->kernel_rtt_ns >= 0)
+    stats_record_kernel(&tg->stats, rtt, (double)res->kernel_rtt_ns / NSEC_PER_MSEC);
+  if (res->reply_ns >= 0) stats_record_reply(&tg->stats, (double)res->reply_ns / NSEC_PER_MSEC);
+  if (hello == HELLO_STAMP && res->reply_ns >= 0)
+    stats_record_oneway(&tg->stats, (double)res->forward_ns / NSEC_PER_MSEC,
+                        (double)res->reverse_ns / NSEC_PER_MSEC);
+  if (rtt < 0) stats_record_failure(&tg->stats, res->reason, ms);
+  stats_record(&tg->stats, rtt);
+  if (shm.slots) shm_publish(&shm, res->target, &tg->stats, res->reason, ms,
+                             res->reply_ns >= 0 ? (double)res->reply_ns / NSEC_PER_MSEC : -1);
+}
+
+/*******************************************************
+ * on_dns - Move targets along with a refreshed name   *
+ *                                                     *
+ * The name's targets keep their address while it      *
+ * still resolves to it, otherwise they switch to the  *
+ * first new one.  Targets probing every address of a  *
+ * name stay where they are.  The resolver runs on the *
+ * main thread, so the new address goes to the shard   *
+ * owning each target, which takes it before its next  *
+ * ping; the entry remembers where its targets are, so *
+ * their own addresses are never read here.  If a      *
+ * shard's ring is full the move is tried again on the *
+ * next refresh.                                       *
+ *******************************************************/
+void on_dns(struct dns_resolver *r, int entry, void *ctx) {
+  struct engine *eng = ctx;
+  struct dns_entry *e = &r->entries[entry];
+  struct target *tg;
+  struct addr_update up;
+  char addr[INET6_ADDRSTRLEN];
+  boolean moved = TRUE;
+  int i, j;
+
+  for (j = 0; j < e->naddrs; j++) {
+    if (e->addrs[j].sa.sa_family != e->current.sa.sa_family) continue;
+    if (e->addrs[j].sa.sa_family == AF_INET6
+        ? memcmp(&e->addrs[j].in6.sin6_addr, &e->current.in6.sin6_addr, 16) == 0
+        : e->addrs[j].in4.sin_addr.s_addr == e->current.in4.sin_addr.s_addr) return;
+  }
+
+  // The list, multi and port never change once pinging starts, so walking them races with nothing
+  for (i = e->targets; i >= 0; i = tg->dns_next) {
+    tg = &table.targets[i];
+    if (tg->multi) continue;
+    memset(&up, 0, sizeof(up));
+    up.target = i;
+    up.addr = e->addrs[0];
+    if (up.addr.sa.sa_family == AF_INET6) up.addr.in6.sin6_port = htons(tg->port);
+    else up.addr.in4.sin_port = htons(tg->port);
+    if (eng->syn) syn_route(&up.addr, &up.source);
+    if (!update_push(&shards[i % nshards].updates, &up)) {
+      moved = FALSE;
+      continue;
+    }
+    if (display == 0) {
+      printf("%s now resolves to %s\n", target_name(&table, i), address_string(&up.addr, addr, sizeof(addr)));
+      fflush(stdout);
+    }
+  }
+  if (moved) e->current = e->addrs[0];
+}
+
+/**********************************************
+ * on_dns_readable - Resolver socket callback *
+ **********************************************/
+void on_dns_readable(void *ctx) {
+  dns_read(ctx);
+}
+
+/****************************************************
+ * print_stats - Display the statistics of a target *
+ *                                                  *
+ * Uses the layout selected with --display.  rto is *
+ * NULL unless timeouts are adaptive.  Failures are *
+ * broken down by reason when there were any, and   *
+ * hello answer times get a line of their own.      *
+ ****************************************************/
+void print_stats(const char *name, const struct ping_stats *st, const struct rto *rto, double total_time) {
+  static const char *clean_names[PROBE_REASONS] = { "", "Timeouts", "OtherErrors", "Refused", "Unreachable", "LocalErrors" };
+  static const probe_reason order[PROBE_REASONS - 1] = { REASON_REFUSED, REASON_UNREACHABLE, REASON_TIMEOUT, REASON_LOCAL, REASON_OTHER };
+  double stat_ave = stats_ave(st), jitter = stats_jitter(st), ping_loss = stats_loss(st);
+  const struct reason_stats *rs;
+  const char *reply = hello == HELLO_TLS ? "Tls" : hello == HELLO_HTTP ? "Ttfb" : hello == HELLO_STAMP ? "Stamp" : "Reply";
+  int i, r;
+
+  if (display == 0 || display == 1) {
+    printf("--- %s tcp ping statistics ---\n", name);
+    printf("%d pings, %d success, %d failed, %0.1f%% loss, total run time: %0.3f ms\n",
+	   st->ping_count, st->ping_success, st->ping_fail, ping_loss, total_time);
+    printf("rtt min/ave/max/range/jitter = %0.3f/%0.3f/%0.3f/%0.3f/%0.3f ms\n", st->stat_min, stat_ave, st->stat_max, st->stat_max - st->stat_min, jitter);
+    if (percentile_count) {
+      printf("rtt ");
+      for (i = 0; i < percentile_count; i++) printf("%sp%g", i ? "/" : "", percentiles[i]);
+      printf(" =");
+      for (i = 0; i < percentile_count; i++) printf("%s%0.3f", i ? "/" : " ", stats_percentile(st, percentiles[i]));
+      printf(" ms\n");
+    }
+    if (st->kernel_count)
+      printf("kernel rtt min/ave/max = %0.3f/%0.3f/%0.3f ms, user-space overhead = %0.3f ms\n",
+             st->kernel_min, st->kernel_sum / st->kernel_count, st->kernel_max, st->overhead_sum / st->kernel_count);
+    if (st->reply_count) {
+      printf("%s min/ave/max = %0.3f/%0.3f/%0.3f ms", hello == HELLO_NONE ? "reply" : hello_name(hello),
+             st->reply_min, st->reply_sum / st->reply_count, st->reply_max);
+      if (percentile_count) {
+        printf(", ");
+        for (i = 0; i < percentile_count; i++) printf("%sp%g", i ? "/" : "", percentiles[i]);
+        printf(" =");
+        for (i = 0; i < percentile_count; i++) printf("%s%0.3f", i ? "/" : " ", stats_reply_percentile(st, percentiles[i]));
+        printf(" ms");
+      }
+      printf("\n");
+    }
+    if (st->oneway_count)
+      printf("one-way fwd/rev min = %0.3f/%0.3f ms, ave = %0.3f/%0.3f ms\n", st->forward_min, st->reverse_min,
+             st->forward_sum / st->oneway_count, st->reverse_sum / st->oneway_count);
+    if (rto)
+      printf("timeout srtt/rttvar/rto = %0.3f/%0.3f/%0.3f ms\n", (double)rto->srtt_ns / NSEC_PER_MSEC,
+             (double)rto->rttvar_ns / NSEC_PER_MSEC, (double)rto->rto_ns / NSEC_PER_MSEC);
+    if (st->ping_fail) {
+      printf("failures:");
+      for (i = 0; i < PROBE_REASONS - 1; i++)
+        printf("%s %d %s", i ? "," : "", st->reasons[order[i]].count, probe_reason_name(order[i]));
+      printf("\n");
+    }
+    // A RST or ICMP error is an answer with a timing worth seeing
+    for (r = REASON_OK + 1; r < PROBE_REASONS; r++) {
+      rs = &st->reasons[r];
+      if (rs->count == 0 || !stats_reason_hist(st, r)) continue;
+      printf("%s min/ave/max = %0.3f/%0.3f/%0.3f ms", probe_reason_name(r), rs->min, rs->sum / rs->count, rs->max);
+      if (percentile_count) {
+        printf(", ");
+        for (i = 0; i < percentile_count; i++) printf("%sp%g", i ? "/" : "", percentiles[i]);
+        printf(" =");
+        for (i = 0; i < percentile_count; i++) printf("%s%0.3f", i ? "/" : " ", stats_reason_percentile(st, r, percentiles[i]));
+        printf(" ms");
+      }
+      printf("\n");
+    }
+  }
+  if (display == 2) {
+    printf("Pings: %d\n", st->ping_count);
+    printf("Min: %0.3f\n", st->stat_min);
+    printf("Max: %0.3f\n", st->stat_max);
+    printf("Ave: %0.3f\n", stat_ave);
+    printf("Jitter: %0.3f\n", jitter);
+    printf("Loss: %0.1f\n", ping_loss);
+    for (i = 0; i < percentile_count; i++)
+      printf("P%g: %0.3f\n", percentiles[i], stats_percentile(st, percentiles[i]));
+    if (error_ns >= 0) {
+      printf("Floor: %0.3f\n", (double)calib.floor_ns / NSEC_PER_MSEC);
+      printf("Subtracted: %0.3f\n", (double)subtract_ns / NSEC_PER_MSEC);
+      printf("Error: %0.3f\n", (double)error_ns / NSEC_PER_MSEC);
+    }
+    if (st->kernel_count) {
+      printf("KernelMin: %0.3f\n", st->kernel_min);
+      printf("KernelMax: %0.3f\n", st->kernel_max);
+      printf("KernelAve: %0.3f\n", st->kernel_sum / st->kernel_count);
+      printf("Overhead: %0.3f\n", st->overhead_sum / st->kernel_count);
+    }
+    if (st->reply_count) {
+      printf("%sMin: %0.3f\n", reply, st->reply_min);
+      printf("%sMax: %0.3f\n", reply, st->reply_max);
+      printf("%sAve: %0.3f\n", reply, st->reply_sum / st->reply_count);
+      for (i = 0; i < percentile_count; i++)
+        printf("%sP%g: %0.3f\n", reply, percentiles[i], stats_reply_percentile(st, percentiles[i]));
+    }
+    if (st->oneway_count) {
+      printf("FwdMin: %0.3f\n", st->forward_min);
+      printf("FwdAve: %0.3f\n", st->forward_sum / st->oneway_count);
+      printf("RevMin: %0.3f\n", st->reverse_min);
+      printf("RevAve: %0.3f\n", st->reverse_sum / st->oneway_count);
+    }
+    if (rto) {
+      printf("Srtt: %0.3f\n", (double)rto->srtt_ns / NSEC_PER_MSEC);
+      printf("Rttvar: %0.3f\n", (double)rto->rttvar_ns / NSEC_PER_MSEC);
+      printf("Rto: %0.3f\n", (double)rto->rto_ns / NSEC_PER_MSEC);
+    }
+    for (i = 0; i < PROBE_REASONS - 1; i++) {
+      r = order[i];
+      rs = &st->reasons[r];
+      if (rs->count == 0) continue;
+      printf("%s: %d\n", clean_names[r], rs->count);
+      if (stats_reason_hist(st, r)) printf("%sAve: %0.3f\n", clean_names[r], rs->sum / rs->count);
+    }
+  }
 }
 
 /*****************************************************
@@ -144,6 +551,371 @@ int is_number(char *str, int maxint) {
   return rvalue;
 }
 
+/*******************************************************
+ * is_decimal - Checks to see if a string is a decimal *
+ *                                                     *
+ * Same as is_number but also allows a single decimal  *
+ * point, as in 0.25 or .5                             *
+ *******************************************************/
+int is_decimal(char *str, int maxint) {
+  int rvalue = FALSE;
+  int dots = 0;
+  int i;
+  for (i=0; i < maxint; i++) {
+    if (str[i] == 0) break; // End of line
+    if (str[i] == '.' && ++dots == 1) continue; // First decimal point
+    if (isdigit(str[i])) rvalue = TRUE; // Found a digit
+    if (! isdigit(str[i])) { // Found a non-digit before the end
+      rvalue = FALSE;
+      break;
+    }
+  }
+  return rvalue;
+}
+
+/******************************************************
+ * parse_percentiles - Read a comma separated list of *
+ *                     percentiles such as 50,99,99.9 *
+ *                                                    *
+ * Returns the number of percentiles, -1 if the list  *
+ * is malformed.  An empty list or "none" turns the   *
+ * percentile report off.                             *
+ ******************************************************/
+int parse_percentiles(char *list, double *out, int max) {
+  char buf[LEN];
+  char *item, *save;
+  int n = 0;
+
+  if (strncmp(list, "none", LEN) == 0) return 0;
+  strncpy(buf, list, LEN - 1);
+  buf[LEN - 1] = 0;
+  for (item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    if (n == max || !is_decimal(item, LEN)) return -1;
+    out[n] = atof(item);
+    if (out[n] <= 0 || out[n] > 100) return -1;
+    n++;
+  }
+  return n;
+}
+
+/******************************************************
+ * analyze - Summarize a probe log                    *
+ *                                                    *
+ * Replays the records of pings sent between from and *
+ * to seconds into the log (to < 0 for the end)       *
+ * through the same statistics as a live run and      *
+ * prints a summary for every target that was pinged. *
+ * Returns the exit status.                           *
+ ******************************************************/
+int analyze(const char *path, double from, double to, int skip) {
+  struct probe_log log;
+  struct ping_stats *stats;
+  const struct plog_record *r;
+  int64_t from_ns = from * NSEC_PER_SEC, to_ns = to < 0 ? INT64_MAX : to * NSEC_PER_SEC;
+  int64_t sent, first = INT64_MAX, last = 0;
+  uint64_t n, used = 0;
+  uint32_t t, ntargets;
+  double ms;
+  char when[64];
+  time_t start;
+
+  if (plog_open(&log, path) < 0) {
+    printf("Cannot read probe log '%s'.\n", path);
+    return 1;
+  }
+  ntargets = log.header->ntargets;
+  stats = malloc(ntargets * sizeof(struct ping_stats));
+  if (ntargets && !stats) {
+    printf("Out of memory!\n");
+    return 1;
+  }
+  for (t = 0; t < ntargets; t++) stats_init(&stats[t], skip);
+
+  // Records are in the order the pings finished, as the live statistics saw them
+  for (n = 0; n < log.capacity; n++) {
+    r = &log.records[n];
+    sent = PLOG_SENT(r);
+    if (sent < from_ns || sent >= to_ns || r->target >= ntargets) continue;
+    if (sent < first) first = sent;
+    if (sent + r->rtt_ns > last) last = sent + r->rtt_ns;
+    ms = (double)r->rtt_ns / NSEC_PER_MSEC;
+    if (PLOG_OUTCOME(r) != REASON_OK) stats_record_failure(&stats[r->target], PLOG_OUTCOME(r), ms);
+    if (PLOG_OUTCOME(r) == REASON_OK) stats_record(&stats[r->target], ms);
+    else if (PLOG_OUTCOME(r) == REASON_TIMEOUT) stats_record(&stats[r->target], -1);
+    else stats_record(&stats[r->target], -2);
+    used++;
+  }
+
+  if (display == 0 || display == 1) {
+    start = (log.header->start_ns + (used ? first : 0)) / NSEC_PER_SEC;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&start));
+    printf("TCP PING LOG %s, %llu pings from %s\n", path, (unsigned long long)used, when);
+  }
+  for (t = 0; t < ntargets; t++) {
+    if (stats[t].ping_count == 0 && stats[t].skip == skip) continue;
+    if (display == 2 && ntargets > 1) printf("Target: %s\n", log.labels[t]);
+    print_stats(log.labels[t], &stats[t], NULL, used ? (double)(last - first) / NSEC_PER_MSEC : 0);
+  }
+  for (t = 0; t < ntargets; t++) stats_free(&stats[t]);
+  free(stats);
+  plog_close(&log);
+  return 0;
+}
+
+/****************************************************
+ * stats_from - Show the live statistics of another *
+ *              tcpping run                         *
+ *                                                  *
+ * Reads the segment a run made with --shm, count   *
+ * times (at least once) interval seconds apart.    *
+ * A slot that stays torn is reported rather than   *
+ * waited on, and fails the exit status.            *
+ * Returns the exit status.                         *
+ ****************************************************/
+int stats_from(const char *name, int count, double interval) {
+  struct shm_stats seg;
+  struct ping_stats st;
+  struct histogram hists[SHM_HISTS];
+  struct timespec now, pause;
+  double uptime;
+  uint32_t t;
+  int n, status = 0;
+
+  if (shm_attach(&seg, name) < 0) {
+    printf("Cannot read statistics segment '%s': %s\n", name, strerror(errno));
+    return 1;
+  }
+  pause.tv_sec = (time_t)interval;
+  pause.tv_nsec = (long)((interval - pause.tv_sec) * NSEC_PER_SEC);
+  for (n = 0; !terminate && (n == 0 || n < count); n++) {
+    if (n) nanosleep(&pause, NULL);
+    clock_gettime(CLOCK_REALTIME, &now);
+    uptime = (double)(now.tv_sec * NSEC_PER_SEC + now.tv_nsec - seg.header->start_ns) / NSEC_PER_MSEC;
+    if (display == 0 || display == 1)
+      printf("TCP PING STATS of pid %d, %u targets\n", seg.header->pid, seg.header->ntargets);
+    for (t = 0; t < seg.header->ntargets; t++) {
+      if (display == 2 && seg.header->ntargets > 1) printf("Target: %s\n", shm_slot_of(&seg, t)->label);
+      if (shm_snapshot(&seg, t, &st, hists) < 0) {
+        printf("%s: statistics torn, %s\n", shm_slot_of(&seg, t)->label,
+               errno == ESRCH ? "the publishing run died mid-update" : "the publishing run is stuck mid-update");
+        status = 1;
+        continue;
+      }
+      print_stats(shm_slot_of(&seg, t)->label, &st, NULL, uptime);
+    }
+    fflush(stdout);
+  }
+  shm_close(&seg);
+  return status;
+}
+
+/****************************************************
+ * reflect - Answer connections instead of pinging  *
+ *                                                  *
+ * Runs nthreads listeners on addr until stopped,   *
+ * reporting the connection rate every interval     *
+ * seconds (with -d all) and the totals at the end. *
+ * Returns the exit status.                         *
+ ****************************************************/
+int reflect(const union sockaddr_any *addr, int nthreads, close_mode closing, boolean stamp, double interval) {
+  struct reflector *lst;
+  struct timespec pause, start, now;
+  cpu_set_t cpus;
+  int ncpus = 0, cpu_list[CPU_SETSIZE];
+  uint64_t total = 0, last = 0, failed, one = 1;
+  int64_t last_ns, now_ns;
+  double run_ms;
+  int stop_fd, k, j;
+
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    for (j = 0; j < CPU_SETSIZE; j++) if (CPU_ISSET(j, &cpus)) cpu_list[ncpus++] = j;
+  if (nthreads == 0) nthreads = ncpus ? ncpus : 1;
+  if (nthreads > MAX_SHARDS) nthreads = MAX_SHARDS;
+  lst = calloc(nthreads, sizeof(struct reflector));
+  stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (!lst || stop_fd < 0) {
+    printf("Out of memory!\n");
+    return 1;
+  }
+  for (k = 0; k < nthreads; k++) {
+    if (reflect_open(&lst[k], addr, stop_fd) < 0) {
+      printf("Cannot listen on port %d: %s\n", sockaddr_port(addr), strerror(errno));
+      return 1;
+    }
+    lst[k].cpu = nthreads > 1 && ncpus ? cpu_list[k % ncpus] : -1;
+    lst[k].closing = closing;
+    lst[k].stamp = stamp;
+  }
+  for (k = 0; k < nthreads; k++) {
+    if (pthread_create(&lst[k].thread, NULL, reflect_run, &lst[k]) != 0) {
+      printf("Cannot start listener thread %d\n", k);
+      return 1;
+    }
+  }
+  if (display == 0 || display == 1)
+    printf("TCP LISTEN port %d, %d thread%s, close %s%s\n", sockaddr_port(addr), nthreads, nthreads == 1 ? "" : "s",
+           closing == CLOSE_FIN ? "fin" : closing == CLOSE_RST ? "rst" : "abort", stamp ? ", stamped" : "");
+  fflush(stdout);
+
+  // Report until stopped
+  pause.tv_sec = (time_t)interval;
+  pause.tv_nsec = (long)((interval - pause.tv_sec) * NSEC_PER_SEC);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  last_ns = (int64_t)start.tv_sec * NSEC_PER_SEC + start.tv_nsec;
+  while (!terminate) {
+    nanosleep(&pause, NULL);
+    if (terminate || display != 0) continue;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_ns = (int64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+    for (k = 0, total = 0; k < nthreads; k++) total += atomic_load_explicit(&lst[k].accepted, memory_order_relaxed);
+    printf("%llu connections, %0.0f/s\n", (unsigned long long)total,
+           (double)(total - last) * NSEC_PER_SEC / (now_ns - last_ns));
+    fflush(stdout);
+    last = total;
+    last_ns = now_ns;
+  }
+
+  // Stop every listener and add up
+  if (write(stop_fd, &one, sizeof(one)) != sizeof(one)) {
+    printf("Cannot stop the listener threads: %s\n", strerror(errno));
+    return 1;
+  }
+  for (k = 0, total = 0, failed = 0; k < nthreads; k++) {
+    pthread_join(lst[k].thread, NULL);
+    total += atomic_load(&lst[k].accepted);
+    failed += atomic_load(&lst[k].failed);
+    reflect_close(&lst[k]);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  run_ms = (double)((now.tv_sec - start.tv_sec) * NSEC_PER_SEC + now.tv_nsec - start.tv_nsec) / NSEC_PER_MSEC;
+  if (display == 0 || display == 1) {
+    printf("\n--- port %d tcpping listen statistics ---\n", sockaddr_port(addr));
+    printf("%llu connections, %llu failed, %0.0f/s, total run time: %0.3f ms\n", (unsigned long long)total,
+           (unsigned long long)failed, run_ms > 0 ? total * 1000.0 / run_ms : 0, run_ms);
+  }
+  if (display == 2) {
+    printf("Connections: %llu\n", (unsigned long long)total);
+    printf("Failed: %llu\n", (unsigned long long)failed);
+    printf("Rate: %0.0f\n", run_ms > 0 ? total * 1000.0 / run_ms : 0);
+  }
+  close(stop_fd);
+  free(lst);
+  return 0;
+}
+
+/*****************************************************
+ * run_shard - Ping a shard's targets until done     *
+ *                                                   *
+ * Addresses the resolver has moved are taken at the *
+ * start of every turn, before any ping goes out.    *
+ *****************************************************/
+void run_shard(struct shard *sh) {
+  struct engine *eng = &sh->eng;
+  struct target *tg;
+  struct addr_update up;
+  int64_t now, until, late;
+  int i, k;
+
+  while (!terminate && (count == 0 || sh->remaining || eng->inflight)) {
+    while (update_pop(&sh->updates, &up)) {
+      table.targets[up.target].addr = up.addr;
+      table.targets[up.target].source = up.source;
+    }
+    now = clock_ns();
+    // Start the next ping of every target whose turn has come around
+    while (eng->nfree && (k = wheel_pop(&sh->schedule, now)) >= 0) {
+      i = k * nshards + sh->id;
+      tg = &table.targets[i];
+      if (engine_probe(eng, &tg->addr, &tg->source, i, tg->sent + 1, tg->rto.rto_ns) < 0) {
+        wheel_set(&sh->schedule, k, tg->next_send_ns);
+        break;
+      }
+      tg->sent++;
+      sh->remaining--;
+      if (count && tg->sent >= count) continue;
+      // Stay on the start + n * interval timeline however long the ping takes
+      tg->next_send_ns += interval_ns;
+      if (tg->next_send_ns < now && interval_ns) {
+        // More than a whole interval behind, give up the missed turns
+        late = (now - tg->next_send_ns) / interval_ns + 1;
+        tg->next_send_ns += late * interval_ns;
+        sh->missed += late;
+      }
+      wheel_set(&sh->schedule, k, tg->next_send_ns);
+    }
+    // The last pings may have failed right away, leaving nothing to wait for
+    if (count && !sh->remaining && !eng->inflight) break;
+    // With every slot busy, wait for one to free up instead
+    until = eng->nfree ? wheel_next(&sh->schedule) : INT64_MAX;
+    engine_poll(eng, until);
+  }
+}
+
+/***************************************************
+ * shard_thread - Worker thread body               *
+ *                                                 *
+ * Pins itself to its CPU, if it has one, runs the *
+ * shard, then lets the main thread know it has    *
+ * finished.                                       *
+ ***************************************************/
+void *shard_thread(void *arg) {
+  struct shard *sh = arg;
+  uint64_t one = 1;
+  cpu_set_t cpus;
+
+  if (sh->cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(sh->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+  run_shard(sh);
+  if (write(done_fd, &one, sizeof(one)) < 0) terminate = TRUE;
+  return NULL;
+}
+
+/************************************************
+ * on_wake - Watch callback that only wakes the *
+ *           loop up                            *
+ ************************************************/
+void on_wake(void *ctx) {
+}
+
+/*********************************************
+ * on_results - Clear the main thread's wake *
+ *              up call                      *
+ *********************************************/
+void on_results(void *ctx) {
+  uint64_t n;
+  if (read(wake_fd, &n, sizeof(n)) < 0) return;
+}
+
+/**************************************************
+ * drain_results - Record what the shards have    *
+ *                 finished                       *
+ *                                                *
+ * Takes a bounded batch from each ring in turn,  *
+ * so one busy shard cannot starve the others or  *
+ * the metrics server.  Returns results recorded. *
+ **************************************************/
+int drain_results(void) {
+  struct probe_result res;
+  int k, n, total = 0;
+
+  for (k = 0; k < nshards; k++) {
+    for (n = 0; n < 4096 && ring_pop(&shards[k].results, &res); n++) record_result(&res);
+    total += n;
+  }
+  return total;
+}
+
+/**************************************************
+ * on_done - Count the workers that have finished *
+ **************************************************/
+void on_done(void *ctx) {
+  uint64_t n;
+  if (read(done_fd, &n, sizeof(n)) == sizeof(n)) *(int *)ctx += n;
+}
+
 /*************************************
  * usage - Print the usage statement *
  *                                   *
@@ -152,19 +924,53 @@ int is_number(char *str, int maxint) {
 void usage(char *binary) {
   printf("tcpping %s\n", version);
   printf("Usage:\n\n");
-  printf("\t%s [OPTIONS] HOSTNAME\n\n", binary);
+  printf("\t%s [OPTIONS] HOSTNAME\n", binary);
+  printf("\t%s [OPTIONS] --targets FILE\n", binary);
+  printf("\t%s [OPTIONS] --analyze FILE\n", binary);
+  printf("\t%s [OPTIONS] --stats-from NAME\n", binary);
+  printf("\t%s [OPTIONS] --listen [ADDR:]PORT\n\n", binary);
   printf("OPTIONS:\n");
-  printf("\t-a, --audible        Audible ping sound\n");
-  printf("\t-c, --count COUNT    Stop after COUNT tcp pings (default: unlimited)\n");
-  printf("\t-p, --port PORT      TCP port number (default: 443)\n");
-  printf("\t-i, --interval SEC   Number of seconds between pings (default: 1)\n");
-  printf("\t-s, --skip COUNT     Number of pings to skip in statistics (default: 0)\n");
-  printf("\t-t, --timeout SEC    Number of seconds to wait for timeout (default: 3)\n");
-  printf("\t-d, --display all    Display all pings and statistics (default)\n");
-  printf("\t              stat   Display only ending statistics\n");
-  printf("\t              clean  Display clean minimal statistics for parsing\n");
-  printf("\t-h, --help           Display this help message\n");
-  printf("\t-v, --version        Display version information\n");
+  printf("\t-a, --audible          Audible ping sound\n");
+  printf("\t-c, --count COUNT      Stop after COUNT tcp pings (default: unlimited)\n");
+  printf("\t-p, --port PORT        TCP port number (default: 443)\n");
+  printf("\t-i, --interval SEC     Number of seconds between pings, down to 0.0001 (default: 1)\n");
+  printf("\t-s, --skip COUNT       Number of pings to skip in statistics (default: 0)\n");
+  printf("\t-t, --timeout SEC      Number of seconds to wait for timeout (default: 3)\n");
+  printf("\t-r, --adaptive K       Adaptive timeout of SRTT + K * RTTVAR per target, up to -t (try 4)\n");
+  printf("\t-d, --display all      Display all pings and statistics (default)\n");
+  printf("\t              stat     Display only ending statistics\n");
+  printf("\t              clean    Display clean minimal statistics for parsing\n");
+  printf("\t              jsonl    One JSON record per ping, no statistics\n");
+  printf("\t-P, --percentiles LIST Percentiles to report, or none (default: 50,90,99,99.9)\n");
+  printf("\t-k, --kernel-rtt       Also show the kernel's own handshake rtt from TCP_INFO\n");
+  printf("\t    --close MODE       Close each connection with fin (default), rst or abort (no packet)\n");
+  printf("\t-H, --hello tls        After connecting, also time a TLS ClientHello to the ServerHello\n");
+  printf("\t            http       After connecting, also time an HTTP request to the first byte\n");
+  printf("\t            stamp      After connecting, split the time to a --listen --stamp timestamp each way\n");
+  printf("\t    --calibrate        Measure tcpping's own rtt floor on loopback first and show an error bound\n");
+  printf("\t    --subtract         Calibrate, then take the floor off every rtt\n");
+  printf("\t    --precise          Pin the workers, lock memory and busy-poll instead of sleeping\n");
+  printf("\t    --fifo             Precise, with the workers at SCHED_FIFO priority\n");
+  printf("\t    --cpu LIST         Pin the workers to these CPUs, comma separated\n");
+  printf("\t-S, --syn              Half-open SYN pings from a raw socket (needs CAP_NET_RAW)\n");
+  printf("\t-T, --targets FILE     Ping every host:port listed in FILE (- for stdin)\n");
+  printf("\t-m, --max-inflight N   Limit on pings waiting at once (default: automatic)\n");
+  printf("\t-A, --all-addresses    Ping every address HOSTNAME resolves to\n");
+  printf("\t-4, --ipv4             Only use IPv4 addresses\n");
+  printf("\t-6, --ipv6             Only use IPv6 addresses\n");
+  printf("\t-R, --resolver ADDR    DNS server as ADDR[:PORT] (default: from /etc/resolv.conf)\n");
+  printf("\t-j, --threads N        Ping from N threads pinned to CPUs, each with its share of the targets\n");
+  printf("\t-M, --metrics PORT     Serve Prometheus metrics on [ADDR:]PORT at /metrics\n");
+  printf("\t    --shm NAME         Publish live statistics in shared memory segment NAME\n");
+  printf("\t    --stats-from NAME  Show the statistics another run publishes (with -c, -i to repeat)\n");
+  printf("\t    --listen PORT      Accept and close connections on [ADDR:]PORT (-j threads, default one per CPU)\n");
+  printf("\t    --stamp            With --listen, send each connection the time it was accepted\n");
+  printf("\t-L, --log FILE         Append every ping to a binary probe log\n");
+  printf("\t    --analyze FILE     Summarize a probe log instead of pinging\n");
+  printf("\t    --from SEC         Only pings sent SEC seconds or more into the log\n");
+  printf("\t    --to SEC           Only pings sent before SEC seconds into the log\n");
+  printf("\t-h, --help             Display this help message\n");
+  printf("\t-v, --version          Display version information\n");
   printf("\n");
 }
 
@@ -172,39 +978,58 @@ void usage(char *binary) {
  * main - Main program function                   *
  *                                                *
  * Gets information from cli, looks up addresses, *
- * runs the tcp ping function, then displays the  *
+ * runs the probe engine, then displays the       *
  * statistical results.                           *
  **************************************************/
 int main(int argc, char *argv[]) {
-  struct hostent *host;    // Host entity
-  struct in_addr h_addr;   // Address Struct
-  char hostname[LEN];      // Hostname
-  char ipaddr[LEN];        // IP Address
+  char hostname[LEN] = ""; // Hostname
+  char *targets_file = NULL; // --targets file name
   int port = 443;          // TCP Port Number
-  int count = 0;           // Number of pings
-  boolean audible = FALSE; // Audible ping
-  // Statistics
-  int seq = 0;           // Sequence number
-  double stat_sum = 0;
-  double stat_min = 0, stat_max = 0, stat_ave = 0;
-  int stat_count = 0;
-  int ping_count = 0; int ping_success = 0; int ping_fail = 0;
-  double ping_loss = 0.0;
   double total_time, diff_sec, diff_nsec;
   struct timespec mainstamp1, mainstamp2; // Keep track of complete elapsed run time
-  int display = 0;  // 0 = All pings and stats, 1 = stats only, 2 = clean
-  int interval = 1; // Number of seconds between pings
-  int skip = 0;     // Number of pings to skip and ignore from stats
+  double interval = 1; // Number of seconds between pings
+  int nslots = 0;          // Probes allowed in flight at once
+  int skip = 0;            // Number of pings to skip and ignore from stats
+  boolean kernel_rtt = FALSE; // Read the kernel's rtt as well
+  boolean syn = FALSE;     // Half-open SYN probing
+  close_mode closing = CLOSE_FIN; // --close strategy
+  boolean all_addresses = FALSE; // One target per resolved address
+  int family = AF_UNSPEC;  // Address family to resolve to
+  char address[INET6_ADDRSTRLEN];
+  size_t len;
+  union sockaddr_any server; // --resolver address
+  boolean have_server = FALSE;
+  char *log_file = NULL;   // --log file name
+  char *analyze_file = NULL; // --analyze file name
+  double from = 0, to = -1; // --analyze time window in seconds
+  union sockaddr_any metrics_addr; // --metrics listening address
+  boolean have_metrics = FALSE;
+  char *shm_name = NULL;   // --shm segment name
+  char *stats_name = NULL; // --stats-from segment name
+  union sockaddr_any listen_addr; // --listen address
+  boolean have_listen = FALSE;
+  boolean stamp = FALSE;   // --stamp the accept time for the client
+  boolean calibrate = FALSE; // Measure tcpping's own floor first
+  boolean subtract = FALSE; // Take the floor off every rtt
+  boolean precise = FALSE; // Pinned, memory locked, busy-polling workers
+  boolean fifo = FALSE;    // Workers at SCHED_FIFO priority
+  int pin_cpus[MAX_SHARDS]; // --cpu list
+  int npin = 0;            // CPUs in it
+  char *cpu_arg, *end;     // --cpu list being read
+  int threads = 0;         // -j as given, 0 if not
+  struct target *tg;
+  struct rlimit nofile = {RLIM_INFINITY, RLIM_INFINITY};
 
   // Signal interception
   struct sigaction action;
+  memset(&action, 0, sizeof(action));
   action.sa_handler = signal_handler;
   sigaction(SIGTERM, &action, NULL); // SIGTERM default kill -15
   sigaction(SIGINT, &action, NULL);  // SIGINT Ctrl-C
   
   // Parse arguments
   int status = 0;
-  int i;
+  int i, j, k;
   for (i=1; i < argc; i++) {
     // Process Options
     if (argv[i][0] == '-') {
@@ -247,8 +1072,8 @@ int main(int argc, char *argv[]) {
       // Interval seconds
       if ((strncmp(argv[i], "-i", LEN) == 0) || (strncmp(argv[i], "--interval", LEN) == 0)) {
 	i++;
-	if (i < argc && is_number(argv[i], LEN)) {
-	  interval = atoi(argv[i]);
+	if (i < argc && is_decimal(argv[i], LEN) && (atof(argv[i]) == 0 || atof(argv[i]) >= 0.0001)) {
+	  interval = atof(argv[i]);
 	} else {
 	  status = -1;
 	  printf("Parse Error: Missing interval seconds.\n");
@@ -259,8 +1084,8 @@ int main(int argc, char *argv[]) {
       // Timeout seconds
       if ((strncmp(argv[i], "-t", LEN) == 0) || (strncmp(argv[i], "--timeout", LEN) == 0)) {
 	i++;
-	if (i < argc && is_number(argv[i], LEN)) {
-	  timeout = atoi(argv[i]);
+	if (i < argc && is_decimal(argv[i], LEN) && atof(argv[i]) >= 0.001) {
+	  timeout = atof(argv[i]);
 	} else {
 	  status = -1;
 	  printf("Parse Error: Missing timeout seconds.\n");
@@ -268,6 +1093,18 @@ int main(int argc, char *argv[]) {
 	}
 	continue;
       }
+      // Adaptive timeout
+      if ((strncmp(argv[i], "-r", LEN) == 0) || (strncmp(argv[i], "--adaptive", LEN) == 0)) {
+	i++;
+	if (i < argc && is_decimal(argv[i], LEN) && atof(argv[i]) > 0) {
+	  adaptive = atof(argv[i]);
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing adaptive timeout multiplier.\n");
+	  break;
+	}
+	continue;
+      }
       // Display settings
       if ((strncmp(argv[i], "-d", LEN) == 0) || (strncmp(argv[i], "--display", LEN) == 0)) {
 	i++;
@@ -276,6 +1113,7 @@ int main(int argc, char *argv[]) {
 	  if (strncmp(argv[i], "all", LEN) == 0) { display = 0; continue; }
 	  if (strncmp(argv[i], "stat", LEN) == 0) { display = 1; continue; }
 	  if (strncmp(argv[i], "clean", LEN) == 0) { display = 2; continue; }
+	  if (strncmp(argv[i], "jsonl", LEN) == 0) { display = 3; continue; }
 	  status = -1;
 	  printf("Parse Error: Missing display setting.\n");
 	  break;	  
@@ -286,6 +1124,234 @@ int main(int argc, char *argv[]) {
 	}
 	continue;
       }
+      // Percentiles
+      if ((strncmp(argv[i], "-P", LEN) == 0) || (strncmp(argv[i], "--percentiles", LEN) == 0)) {
+	i++;
+	if (i < argc && (percentile_count = parse_percentiles(argv[i], percentiles, 16)) >= 0) {
+	  continue;
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing percentile list.\n");
+	  break;
+	}
+      }
+      // Kernel rtt
+      if ((strncmp(argv[i], "-k", LEN) == 0) || (strncmp(argv[i], "--kernel-rtt", LEN) == 0)) {
+	kernel_rtt = TRUE;
+	continue;
+      }
+      // Hello after connecting
+      if ((strncmp(argv[i], "-H", LEN) == 0) || (strncmp(argv[i], "--hello", LEN) == 0)) {
+	i++;
+	if (i < argc) {
+	  if (strncmp(argv[i], "tls", LEN) == 0) { hello = HELLO_TLS; continue; }
+	  if (strncmp(argv[i], "http", LEN) == 0) { hello = HELLO_HTTP; continue; }
+	  if (strncmp(argv[i], "stamp", LEN) == 0) { hello = HELLO_STAMP; continue; }
+	}
+	status = -1;
+	printf("Parse Error: Missing hello (tls, http or stamp).\n");
+	break;
+      }
+      // Close strategy
+      if (strncmp(argv[i], "--close", LEN) == 0) {
+	i++;
+	if (i < argc) {
+	  if (strncmp(argv[i], "fin", LEN) == 0) { closing = CLOSE_FIN; continue; }
+	  if (strncmp(argv[i], "rst", LEN) == 0) { closing = CLOSE_RST; continue; }
+	  if (strncmp(argv[i], "abort", LEN) == 0) { closing = CLOSE_ABORT; continue; }
+	}
+	status = -1;
+	printf("Parse Error: Missing close mode (fin, rst or abort).\n");
+	break;
+      }
+      // Overhead calibration
+      if ((strncmp(argv[i], "--calibrate", LEN) == 0) || (strncmp(argv[i], "--subtract", LEN) == 0)) {
+	calibrate = TRUE;
+	if (strncmp(argv[i], "--subtract", LEN) == 0) subtract = TRUE;
+	continue;
+      }
+      // Precision mode
+      if ((strncmp(argv[i], "--precise", LEN) == 0) || (strncmp(argv[i], "--fifo", LEN) == 0)) {
+	precise = TRUE;
+	if (strncmp(argv[i], "--fifo", LEN) == 0) fifo = TRUE;
+	continue;
+      }
+      if (strncmp(argv[i], "--cpu", LEN) == 0) {
+	i++;
+	npin = 0;
+	cpu_arg = i < argc ? argv[i] : "";
+	while (npin < MAX_SHARDS && isdigit((unsigned char)*cpu_arg)) {
+	  pin_cpus[npin] = strtol(cpu_arg, &end, 10);
+	  if (pin_cpus[npin++] >= CPU_SETSIZE || (*end && *end != ',')) break;
+	  cpu_arg = *end ? end + 1 : end;
+	}
+	if (npin == 0 || *cpu_arg) {
+	  status = -1;
+	  printf("Parse Error: Missing CPU list.\n");
+	  break;
+	}
+	continue;
+      }
+      // SYN probing
+      if ((strncmp(argv[i], "-S", LEN) == 0) || (strncmp(argv[i], "--syn", LEN) == 0)) {
+	syn = TRUE;
+	continue;
+      }
+      // Targets file
+      if ((strncmp(argv[i], "-T", LEN) == 0) || (strncmp(argv[i], "--targets", LEN) == 0)) {
+	i++;
+	if (i < argc) {
+	  targets_file = argv[i];
+	  if (status == 0) status = 1;
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing targets file.\n");
+	  break;
+	}
+	continue;
+      }
+      // Worker threads
+      if ((strncmp(argv[i], "-j", LEN) == 0) || (strncmp(argv[i], "--threads", LEN) == 0)) {
+	i++;
+	if (i < argc && is_number(argv[i], LEN) && atoi(argv[i]) >= 1 && atoi(argv[i]) <= MAX_SHARDS) {
+	  nshards = threads = atoi(argv[i]);
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing thread count (1 to %d).\n", MAX_SHARDS);
+	  break;
+	}
+	continue;
+      }
+      // Prometheus exporter
+      if ((strncmp(argv[i], "-M", LEN) == 0) || (strncmp(argv[i], "--metrics", LEN) == 0)) {
+	i++;
+	if (i < argc && metrics_parse(argv[i], &metrics_addr) == 0) {
+	  have_metrics = TRUE;
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing metrics port.\n");
+	  break;
+	}
+	continue;
+      }
+      // Shared memory statistics
+      if ((strncmp(argv[i], "--shm", LEN) == 0) || (strncmp(argv[i], "--stats-from", LEN) == 0)) {
+	i++;
+	if (i < argc && argv[i][0]) {
+	  if (strncmp(argv[i - 1], "--shm", LEN) == 0) {
+	    shm_name = argv[i];
+	  } else {
+	    stats_name = argv[i];
+	    if (status == 0) status = 1;
+	  }
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing shared memory name.\n");
+	  break;
+	}
+	continue;
+      }
+      // Responder mode
+      if (strncmp(argv[i], "--listen", LEN) == 0) {
+	i++;
+	if (i < argc && metrics_parse(argv[i], &listen_addr) == 0) {
+	  have_listen = TRUE;
+	  if (status == 0) status = 1;
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing listen port.\n");
+	  break;
+	}
+	continue;
+      }
+      if (strncmp(argv[i], "--stamp", LEN) == 0) {
+	stamp = TRUE;
+	continue;
+      }
+      // Probe log
+      if ((strncmp(argv[i], "-L", LEN) == 0) || (strncmp(argv[i], "--log", LEN) == 0)) {
+	i++;
+	if (i < argc) {
+	  log_file = argv[i];
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing log file.\n");
+	  break;
+	}
+	continue;
+      }
+      if (strncmp(argv[i], "--analyze", LEN) == 0) {
+	i++;
+	if (i < argc) {
+	  analyze_file = argv[i];
+	  if (status == 0) status = 1;
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing log file.\n");
+	  break;
+	}
+	continue;
+      }
+      if (strncmp(argv[i], "--from", LEN) == 0) {
+	i++;
+	if (i < argc && is_decimal(argv[i], LEN)) {
+	  from = atof(argv[i]);
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing window time.\n");
+	  break;
+	}
+	continue;
+      }
+      if (strncmp(argv[i], "--to", LEN) == 0) {
+	i++;
+	if (i < argc && is_decimal(argv[i], LEN)) {
+	  to = atof(argv[i]);
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing window time.\n");
+	  break;
+	}
+	continue;
+      }
+      // Maximum pings in flight
+      if ((strncmp(argv[i], "-m", LEN) == 0) || (strncmp(argv[i], "--max-inflight", LEN) == 0)) {
+	i++;
+	if (i < argc && is_number(argv[i], LEN) && atoi(argv[i]) > 0) {
+	  nslots = atoi(argv[i]);
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing max inflight number.\n");
+	  break;
+	}
+	continue;
+      }
+      // Every address of a name
+      if ((strncmp(argv[i], "-A", LEN) == 0) || (strncmp(argv[i], "--all-addresses", LEN) == 0)) {
+	all_addresses = TRUE;
+	continue;
+      }
+      // Address family
+      if ((strncmp(argv[i], "-4", LEN) == 0) || (strncmp(argv[i], "--ipv4", LEN) == 0)) {
+	family = AF_INET;
+	continue;
+      }
+      if ((strncmp(argv[i], "-6", LEN) == 0) || (strncmp(argv[i], "--ipv6", LEN) == 0)) {
+	family = AF_INET6;
+	continue;
+      }
+      // DNS server
+      if ((strncmp(argv[i], "-R", LEN) == 0) || (strncmp(argv[i], "--resolver", LEN) == 0)) {
+	i++;
+	if (i < argc && dns_parse_server(argv[i], &server) == 0) {
+	  have_server = TRUE;
+	} else {
+	  status = -1;
+	  printf("Parse Error: Missing resolver address.\n");
+	  break;
+	}
+	continue;
+      }
       // Audible ping
       if ((strncmp(argv[i], "-a", LEN) == 0) || (strncmp(argv[i], "--audible", LEN) == 0)) {
 	audible = TRUE;
@@ -305,12 +1371,18 @@ int main(int argc, char *argv[]) {
     }
     // Finished Options
     else {
-      if (status > 0) {
+      if (hostname[0]) {
 	status = -1;
 	printf("Parse Error: Cannot determine HOSTNAME.\n");
 	break;
       } else {
-	strncpy(hostname, argv[i], LEN);
+	strncpy(hostname, argv[i], LEN - 1);
+	// Allow an IPv6 address in brackets, [::1]
+	len = strlen(hostname);
+	if (len > 2 && hostname[0] == '[' && hostname[len - 1] == ']') {
+	  memmove(hostname, hostname + 1, len - 2);
+	  hostname[len - 2] = 0;
+	}
 	status = 1;
       }
     }
@@ -322,85 +1394,344 @@ int main(int argc, char *argv[]) {
     exit(0);
   }
 
-  // Get the hostname from the cli
-  if ((host = gethostbyname(hostname)) == NULL) {
-    printf("Lookup for '%s' failed.\n", hostname);
+  // Work from a probe log instead
+  if (analyze_file) return analyze(analyze_file, from, to, skip);
+  if (stats_name) return stats_from(stats_name, count, interval);
+  if (have_listen) {
+    // A RST throws away the stamp at the client if it gets there first
+    if (stamp && closing != CLOSE_FIN) {
+      printf("--stamp needs the stamp delivered, using --close fin instead.\n");
+      closing = CLOSE_FIN;
+    }
+    if (closing == CLOSE_ABORT && !engine_can_abort()) {
+      printf("--close abort needs CAP_NET_ADMIN, using rst instead.\n");
+      closing = CLOSE_RST;
+    }
+    return reflect(&listen_addr, threads, closing, stamp, interval);
+  }
+
+  // Build the target table
+  if (hostname[0]) targets_add(&table, hostname, port);
+  if (targets_file && targets_load(&table, targets_file, port) < 0) {
+    printf("Cannot read targets from '%s'.\n", targets_file);
     exit(1);
   }
-  h_addr.s_addr = *((unsigned long *) host->h_addr_list[0]);
-  strncpy(ipaddr, inet_ntoa(h_addr), LEN);
-  
+  if (dns_init(&resolver, family, have_server ? &server : NULL) < 0) {
+    printf("Resolver setup failed!\n");
+    exit(1);
+  }
+  j = targets_resolve(&table, &resolver, all_addresses);
+  if (j < 0) exit(1);
+  if (j == 0) {
+    if (!targets_file) exit(1);
+    printf("No targets to ping.\n");
+    exit(1);
+  }
+
   // Start ping process
-  if (display == 0 || display == 1)
-    printf("TCP PING %s (%s) tcp port %d\n", hostname, ipaddr, port);
+  if (display == 0 || display == 1) {
+    if (table.count == 1) {
+      tg = &table.targets[0];
+      printf("TCP PING %s (%s) tcp port %d\n", target_name(&table, 0), address_string(&tg->addr, address, sizeof(address)), tg->port);
+    } else {
+      printf("TCP PING %d targets\n", table.count);
+    }
+  }
+
+  // Every waiting ping holds a socket, so make room for as many as allowed
+  if (getrlimit(RLIMIT_NOFILE, &nofile) == 0) {
+    nofile.rlim_cur = nofile.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &nofile);
+    getrlimit(RLIMIT_NOFILE, &nofile);
+  }
+  // Probes overlap when the timeout is longer than the interval: a target can have a timeout's
+  // worth of intervals waiting, doubled for slack, but never more than it sends in all
+  interval_ns = (int64_t)(interval * NSEC_PER_SEC + 0.5);
+  timeout_ns = (int64_t)(timeout * NSEC_PER_SEC + 0.5);
+  int64_t want = nslots;
+  int64_t overlap = interval_ns ? (timeout_ns + interval_ns - 1) / interval_ns * 2 : 1;
+  if (count && overlap > count) overlap = count;
+  if (want == 0) want = table.count * (overlap > 1 ? overlap : 1);
+  if (nshards > table.count) nshards = table.count;
+  shards = calloc(nshards, sizeof(struct shard));
+  if (!shards) {
+    printf("Out of memory!\n");
+    exit(1);
+  }
+  // Every target's hello is built once, so a probe only has to send it
+  struct iovec *hellos = NULL; // What each target's probes send after connecting
+  uint8_t *hello_bytes = NULL; // HELLO_MAX bytes per target behind hellos
+  int hello_len;
+  if (hello != HELLO_NONE) {
+    if (syn) {
+      printf("--hello needs full connections, using connect() instead.\n");
+      syn = FALSE;
+    }
+    hellos = calloc(table.count, sizeof(struct iovec));
+    hello_bytes = malloc((size_t)table.count * HELLO_MAX);
+    if (!hellos || !hello_bytes) {
+      printf("Out of memory!\n");
+      exit(1);
+    }
+    for (i = 0; i < table.count; i++) {
+      hellos[i].iov_base = hello_bytes + (size_t)i * HELLO_MAX;
+      hello_len = hello_build(hello, target_name(&table, i), table.targets[i].port, hellos[i].iov_base, HELLO_MAX);
+      hellos[i].iov_len = hello_len > 0 ? hello_len : 0;
+    }
+  }
+
+  // Every shard gets an equal share of the slots; when full, pings wait for one to free up
+  want = (want + nshards - 1) / nshards;
+  if (nslots == 0 && want > AUTO_SLOTS) want = AUTO_SLOTS;
+  if (want > SYN_SLOTS) want = SYN_SLOTS;
+  for (k = 0; syn && k < nshards; k++) {
+    // SYN probes share one raw socket per shard, so only the id space limits them
+    if (engine_init(&shards[k].eng, want, timeout_ns, on_result, &shards[k]) < 0) {
+      printf("Probe engine setup failed!\n");
+      exit(1);
+    }
+    if (engine_syn(&shards[k].eng, SYN_PORTS) < 0) {
+      if (errno == EPERM || errno == EACCES)
+        printf("SYN mode needs CAP_NET_RAW, using connect() instead.\n");
+      else
+        printf("SYN mode unavailable (%s), using connect() instead.\n", strerror(errno));
+      for (j = 0; j <= k; j++) engine_free(&shards[j].eng);
+      syn = FALSE;
+    }
+  }
+  if (!syn) {
+    if (closing == CLOSE_ABORT && !engine_can_abort()) {
+      printf("--close abort needs CAP_NET_ADMIN, using rst instead.\n");
+      closing = CLOSE_RST;
+    }
+    if (nofile.rlim_cur != RLIM_INFINITY && (rlim_t)want * (rlim_t)nshards + 16 > nofile.rlim_cur)
+      want = nofile.rlim_cur > 32 + 16 * (rlim_t)nshards ? (nofile.rlim_cur - 16) / nshards : 16;
+    for (k = 0; k < nshards; k++) {
+      if (engine_init(&shards[k].eng, want, timeout_ns, on_result, &shards[k]) < 0) {
+        printf("Probe engine setup failed!\n");
+        exit(1);
+      }
+      shards[k].eng.kernel_rtt = kernel_rtt;
+      shards[k].eng.closing = closing;
+      shards[k].eng.hello = hello;
+      shards[k].eng.hellos = hellos;
+    }
+  }
+
+  // The workers ping while the main thread records their results and serves metrics
+  struct engine control;   // Main thread's loop while workers ping
+  int finished = 0;        // Workers done
+  stop_fd = eventfd(0, EFD_CLOEXEC);
+  done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (stop_fd < 0 || done_fd < 0 || wake_fd < 0 || engine_init(&control, 1, timeout_ns, on_result, NULL) < 0 ||
+      engine_watch(&control, done_fd, on_done, &finished) < 0 || engine_watch(&control, wake_fd, on_results, NULL) < 0) {
+    printf("Worker setup failed!\n");
+    exit(1);
+  }
+  for (k = 0; k < nshards; k++) {
+    engine_watch(&shards[k].eng, stop_fd, on_wake, NULL);
+    if (ring_init(&shards[k].results) < 0 || update_init(&shards[k].updates, (table.count + nshards - 1) / nshards) < 0) {
+      printf("Out of memory!\n");
+      exit(1);
+    }
+  }
+
+  // Names are looked up again by the main thread as their TTLs run out
+  resolver.on_update = on_dns;
+  resolver.ctx = &shards[0].eng;
+  if (resolver.fd >= 0 && engine_watch(&control, resolver.fd, on_dns_readable, &resolver) < 0) {
+    printf("Worker setup failed!\n");
+    exit(1);
+  }
+
+  // SYNs carry their own source address, so look up each target's route once
+  for (i = 0; syn && i < table.count; i++) {
+    tg = &table.targets[i];
+    if (syn_route(&tg->addr, &tg->source) < 0)
+      printf("No route to '%s'.\n", target_name(&table, i));
+  }
+
+  // A spinning worker needs a CPU to itself, with one left for the main thread and the kernel
+  cpu_set_t cpus;
+  if (precise && sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) <= nshards) {
+    printf("--precise needs more CPUs than workers, sleeping instead of busy-polling.\n");
+    fifo = FALSE;
+  } else {
+    // Precise workers never sleep, so the calibration has to spin as well
+    for (k = 0; k < nshards; k++) shards[k].eng.spin = precise;
+  }
+
+  // Measure what tcpping itself adds to an rtt before the workers start
+  if (calibrate && calib_run(&calib, &shards[0].eng, interval_ns) < 0) {
+    printf("Calibration failed (%s), rtts are not corrected.\n", strerror(errno));
+    calibrate = FALSE;
+  }
+  if (calibrate) {
+    if (subtract) subtract_ns = calib.floor_ns;
+    error_ns = calib_error(&calib, subtract);
+    if (display == 0 || display == 1)
+      printf("calibration: clock read %lld ns, loopback %s min/p50/p90 = %0.3f/%0.3f/%0.3f ms, %s %0.3f ms, error %0.3f ms\n",
+             (long long)calib.clock_ns, syn ? "SYN" : "handshake", (double)calib.floor_ns / NSEC_PER_MSEC,
+             (double)calib.median_ns / NSEC_PER_MSEC, (double)calib.p90_ns / NSEC_PER_MSEC,
+             subtract ? "subtracting" : "floor", (double)calib.floor_ns / NSEC_PER_MSEC, (double)error_ns / NSEC_PER_MSEC);
+  }
+
+  // JSON Lines records and the probe log are stamped with the wall clock
+  clock_gettime(CLOCK_REALTIME, &mainstamp1);
+  wall_offset_ns = mainstamp1.tv_sec * NSEC_PER_SEC + mainstamp1.tv_nsec - clock_ns();
+  if (display == 3) {
+    json_targets = calloc(table.count, sizeof(char *));
+    json_addrs = calloc(table.count, sizeof(union sockaddr_any));
+    if (!json_targets || !json_addrs || out_init(&out, STDOUT_FILENO) < 0) {
+      printf("Out of memory!\n");
+      exit(1);
+    }
+    for (i = 0; i < table.count; i++) json_target(i, &table.targets[i].addr);
+  }
+  if (log_file || have_metrics || shm_name) {
+    // Targets are logged and exported under the names the summary uses
+    char (*labels)[LABEL_LEN] = malloc(table.count * sizeof(*labels));
+    const char **names = malloc(table.count * sizeof(char *));
+    if (!labels || !names) {
+      printf("Out of memory!\n");
+      exit(1);
+    }
+    for (i = 0; i < table.count; i++) {
+      summary_name(i, labels[i], LABEL_LEN);
+      names[i] = labels[i];
+    }
+    if (log_file && plog_create(&plog, log_file, names, table.count, clock_ns() + wall_offset_ns) < 0) {
+      printf("Cannot create probe log '%s': %s\n", log_file, strerror(errno));
+      exit(1);
+    }
+    if (have_metrics && (metrics_init(&metrics, &metrics_addr, names, table.count) < 0 ||
+                         engine_watch(&control, metrics.epfd, metrics_poll, &metrics) < 0)) {
+      printf("Cannot serve metrics: %s\n", strerror(errno));
+      exit(1);
+    }
+    if (shm_name && shm_create(&shm, shm_name, names, table.count, clock_ns() + wall_offset_ns, hello != HELLO_NONE) < 0) {
+      printf("Cannot create statistics segment '%s': %s\n", shm_name, strerror(errno));
+      exit(1);
+    }
+    free(names);
+    free(labels);
+  }
 
   // Read clock before starting tcp pinging
   clock_gettime(CLOCK_MONOTONIC_RAW, &mainstamp1);
 
-  int countdown = count;
-  double rtt;
-  double diff, prev_rtt = -1, jitter = 0, jitter_total = 0; // Jitter statistics
-  int jitter_count = 0;
-  while(!terminate && (count == 0 || countdown)) {
-    // single ping
-    rtt = tcp_ping(ipaddr, port);
-    seq++;
+  // Spread the first pings of every target evenly across one interval
+  int64_t start = clock_ns();
+  for (k = 0; k < nshards; k++) {
+    shards[k].id = k;
+    shards[k].cpu = -1;
+    shards[k].ntargets = (table.count - k + nshards - 1) / nshards;
+    shards[k].remaining = (int64_t)count * shards[k].ntargets;
+    if (wheel_init(&shards[k].schedule, shards[k].ntargets, start) < 0) {
+      printf("Out of memory!\n");
+      exit(1);
+    }
+  }
+  for (i = 0; i < table.count; i++) {
+    tg = &table.targets[i];
+    stats_init(&tg->stats, skip);
+    rto_init(&tg->rto, timeout_ns, adaptive);
+    tg->next_send_ns = start + interval_ns * i / table.count;
+    wheel_set(&shards[i % nshards].schedule, i / nshards, tg->next_send_ns);
+  }
+
+  // With several workers or --precise, one per CPU we may run on (or --cpu), wrapping around if there are more workers
+  int ncpus = 0, cpu_list[CPU_SETSIZE];
+  if ((nshards > 1 || precise || npin) && sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    for (j = 0; j < CPU_SETSIZE; j++) if (CPU_ISSET(j, &cpus)) cpu_list[ncpus++] = j;
+  for (j = 0; ncpus && j < npin; j++) {
+    if (!CPU_ISSET(pin_cpus[j], &cpus)) {
+      printf("CPU %d is not available, using CPUs in order instead.\n", pin_cpus[j]);
+      npin = 0;
+    }
+  }
+  if (npin) for (k = 0; k < nshards; k++) shards[k].cpu = pin_cpus[k % npin];
+  else for (k = 0; ncpus && k < nshards; k++) shards[k].cpu = cpu_list[k % ncpus];
 
-    // Display audible bell (if requested)
-    if (audible) printf("\a");
+  // Keep every page resident so no probe waits on a fault
+  if (precise && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    printf("Cannot lock memory (%s), continuing without.\n", strerror(errno));
 
-    // Display RTT latency
-    if (display == 0) {
-      if (rtt > 0) {
-	if (skip) printf("%s: seq=%d time=%0.3f ms (skip: %d)\n", ipaddr, seq, rtt, skip);
-	else printf("%s: seq=%d time=%0.3f ms\n", ipaddr, seq, rtt);
-      } else {
-	if (rtt == -1) {
-	  if (skip) printf("%s: seq=%d timeout(%d) (skip: %d)\n", ipaddr, seq, timeout, skip);
-	  else printf("%s: seq=%d timeout(%d)\n", ipaddr, seq, timeout);
-	}
-	if (rtt == -2) {
-	  if (skip) printf("%s: seq=%d connection error (skip: %d)\n", ipaddr, seq, skip);
-	  else printf("%s: seq=%d connection error\n", ipaddr, seq);
-	}
-      }
+  // The lowest real-time priority is enough to preempt every normal task
+  pthread_attr_t attr;
+  struct sched_param param = { .sched_priority = sched_get_priority_min(SCHED_FIFO) };
+  pthread_attr_init(&attr);
+  if (fifo) {
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+
+  // Signals go to the main thread, which stops the workers
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+  for (k = 0; k < nshards; k++) {
+    j = pthread_create(&shards[k].thread, &attr, shard_thread, &shards[k]);
+    if (j == EPERM && fifo) {
+      printf("SCHED_FIFO needs CAP_SYS_NICE, using normal priority instead.\n");
+      fifo = FALSE;
+      pthread_attr_destroy(&attr);
+      pthread_attr_init(&attr);
+      j = pthread_create(&shards[k].thread, &attr, shard_thread, &shards[k]);
+    }
+    if (j != 0) {
+      printf("Cannot start worker thread!\n");
+      exit(1);
     }
+  }
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
 
-    // Update statistics
-    if (skip) {
-      skip--;
+  uint64_t one = 1;
+  boolean stopping = FALSE;
+  int64_t until;
+  for (;;) {
+    if (terminate && !stopping) stopping = write(stop_fd, &one, sizeof(one)) == sizeof(one);
+    if (drain_results()) {
+      // Keep serving scrapes under a steady stream of results
+      engine_poll(&control, 0);
     } else {
-      ping_count++;
-      if (rtt > 0) {
-	ping_success++;
-	stat_sum += rtt;  // Update sum stats
-	stat_count++;     // Update total recorded stats
-	if (prev_rtt == -1) { // Jitter staticistis
-	  prev_rtt = rtt;
-	} else {
-	  diff = prev_rtt - rtt;
-	  if (diff < 0) diff = 0 - diff;
-	  jitter_total += diff;
-	  prev_rtt = rtt;
-	  jitter_count++;
-	  jitter = jitter_total / jitter_count;
-	}
-	if (stat_count == 1) {
-	  stat_min = stat_max = rtt;
-	}
-	if (rtt < stat_min) stat_min = rtt;
-	if (rtt > stat_max) stat_max = rtt;
-	stat_ave = stat_sum / stat_count;
-      } else {
-	ping_fail++;
-      }
-      ping_loss = (double)ping_fail / (double)ping_count * 100;
+      // Every result a finished worker pushed was in its ring before it said so
+      if (finished == nshards) break;
+      atomic_store(&output_sleeping, 1);
+      for (k = 0; k < nshards && ring_empty(&shards[k].results); k++);
+      until = dns_next(&resolver) < out.flush_ns ? dns_next(&resolver) : out.flush_ns;
+      if (k == nshards) engine_poll(&control, until);
+      atomic_store(&output_sleeping, 0);
     }
-    
-    // Update countdown
-    countdown--;
-    if (countdown) sleep(interval);
+    dns_process(&resolver, clock_ns());
+    if (clock_ns() >= out.flush_ns) out_flush(&out);
   }
+  for (k = 0; k < nshards; k++) pthread_join(shards[k].thread, NULL);
+  engine_free(&control);
+  close(stop_fd);
+  close(done_fd);
+  close(wake_fd);
+
+  int64_t missed = 0;  // Turns skipped because a loop fell behind
+  uint64_t dropped = 0; // Results lost to a full ring
+  for (k = 0; k < nshards; k++) {
+    missed += shards[k].missed;
+    dropped += shards[k].results.dropped;
+    engine_free(&shards[k].eng);
+    wheel_free(&shards[k].schedule);
+    ring_free(&shards[k].results);
+    update_free(&shards[k].updates);
+  }
+  free(shards);
+  out_free(&out);
+  plog_close(&plog);
+  metrics_free(&metrics);
+  shm_close(&shm);
 
   // Read clock after stopping tcp pinging
   clock_gettime(CLOCK_MONOTONIC_RAW, &mainstamp2);
@@ -410,19 +1741,25 @@ int main(int argc, char *argv[]) {
   total_time+= diff_nsec / 1000000;
 
   // Display statistics
-  if (display == 0 || display == 1) {
-    printf("--- %s tcp ping statistics ---\n", hostname);
-    printf("%d pings, %d success, %d failed, %0.1f%% loss, total run time: %0.3f ms\n",
-	   ping_count, ping_success, ping_fail, ping_loss, total_time);
-    printf("rtt min/ave/max/range/jitter = %0.3f/%0.3f/%0.3f/%0.3f/%0.3f ms\n", stat_min, stat_ave, stat_max, stat_max - stat_min, jitter);
-  }
-  if (display == 2) {
-    printf("Pings: %d\n", ping_count);
-    printf("Min: %0.3f\n", stat_min);
-    printf("Max: %0.3f\n", stat_max);
-    printf("Ave: %0.3f\n", stat_ave);
-    printf("Jitter: %0.3f\n", jitter);
-    printf("Loss: %0.1f\n", ping_loss);
+  char name[LABEL_LEN];
+  for (i = 0; i < table.count; i++) {
+    tg = &table.targets[i];
+    summary_name(i, name, sizeof(name));
+    if (table.count > 1 && display == 2) printf("Target: %s\n", name);
+    print_stats(name, &tg->stats, adaptive ? &tg->rto : NULL, total_time);
   }
+  if (missed && display < 2)
+    printf("%lld ping turns missed, interval too short for the load\n", (long long)missed);
+  if (no_port && display < 2)
+    printf("%lld pings found no free local port, lower the rate or try --close rst\n", (long long)no_port);
+  if (dropped && display < 2)
+    printf("%llu ping results dropped, output could not keep up\n", (unsigned long long)dropped);
+  for (i = 0; json_targets && i < table.count; i++) free(json_targets[i]);
+  free(json_targets);
+  free(json_addrs);
+  free(hellos);
+  free(hello_bytes);
+  targets_free(&table);
+  dns_free(&resolver);
   return 0;
 }
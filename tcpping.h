@@ -0,0 +1,81 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef TCPPING_H
+#define TCPPING_H
+
+#include <time.h>      // Clock
+#include <stdint.h>    // int64_t
+#include <signal.h>    // sig_atomic_t
+#include <netinet/in.h> // sockaddr_in, sockaddr_in6
+
+/*************************
+ * Globals and Constants *
+ *************************/
+typedef enum {FALSE = 0, TRUE = 1} boolean;
+#define NSEC_PER_SEC  1000000000LL
+#define NSEC_PER_MSEC 1000000LL
+
+extern volatile sig_atomic_t terminate; // SIGTERM, SIGINT triggered
+
+/******************************************************
+ * probe_reason - Why a ping ended the way it did     *
+ *                                                    *
+ * The first three match the old ok, timeout and      *
+ * error outcomes, which probe logs store in the same *
+ * byte, so older logs still read correctly.          *
+ ******************************************************/
+typedef enum {
+  REASON_OK = 0,      // Handshake completed
+  REASON_TIMEOUT,     // No answer before the deadline
+  REASON_OTHER,       // Any error not listed below
+  REASON_REFUSED,     // The target answered with a RST
+  REASON_UNREACHABLE, // ICMP host or network unreachable
+  REASON_LOCAL,       // Out of ports, descriptors or memory on this host
+  PROBE_REASONS
+} probe_reason;
+
+/***************************************************
+ * sockaddr_any - An IPv4 or IPv6 socket address   *
+ *                                                 *
+ * Big enough for either family without carrying a *
+ * whole sockaddr_storage around for every target. *
+ ***************************************************/
+union sockaddr_any {
+  struct sockaddr sa;
+  struct sockaddr_in in4;
+  struct sockaddr_in6 in6;
+};
+
+/***********************************************
+ * sockaddr_len - Length to pass along with an *
+ *                address                      *
+ ***********************************************/
+static inline socklen_t sockaddr_len(const union sockaddr_any *addr) {
+  return addr->sa.sa_family == AF_INET6 ? sizeof(addr->in6) : sizeof(addr->in4);
+}
+
+/***************************************************
+ * sockaddr_port - Port of an address (host order) *
+ ***************************************************/
+static inline uint16_t sockaddr_port(const union sockaddr_any *addr) {
+  return ntohs(addr->sa.sa_family == AF_INET6 ? addr->in6.sin6_port : addr->in4.sin_port);
+}
+
+/**************************************************
+ * clock_ns - Read the measurement clock          *
+ *                                                *
+ * Returns CLOCK_MONOTONIC_RAW in nanoseconds.    *
+ * All RTT and deadline math is done on this one. *
+ **************************************************/
+static inline int64_t clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#include <stdlib.h> // calloc
+#include <string.h> // memset
+#include "wheel.h"
+
+#define BUCKET_MASK (WHEEL_BUCKETS - 1)
+#define BUSY_WORDS  (WHEEL_BUCKETS / 64)
+
+/***************************************************
+ * wheel_init - Allocate a wheel for nnodes timers *
+ *                                                 *
+ * Returns 0 on success, -1 when out of memory.    *
+ ***************************************************/
+int wheel_init(struct wheel *w, int nnodes, int64_t now) {
+  int i;
+
+  memset(w, 0, sizeof(*w));
+  w->nodes = calloc(nnodes, sizeof(struct wheel_node));
+  w->heads = malloc(WHEEL_BUCKETS * sizeof(int));
+  w->busy = calloc(BUSY_WORDS, sizeof(uint64_t));
+  if (!w->nodes || !w->heads || !w->busy) {
+    wheel_free(w);
+    return -1;
+  }
+  for (i = 0; i < nnodes; i++) w->nodes[i].bucket = -1;
+  for (i = 0; i < WHEEL_BUCKETS; i++) w->heads[i] = -1;
+  w->nnodes = nnodes;
+  w->tick = now >> WHEEL_TICK_SHIFT;
+  return 0;
+}
+
+/********************************
+ * wheel_free - Release a wheel *
+ ********************************/
+void wheel_free(struct wheel *w) {
+  free(w->nodes);
+  free(w->heads);
+  free(w->busy);
+  memset(w, 0, sizeof(*w));
+}
+
+/*****************************************
+ * wheel_clear - Cancel a timer          *
+ *                                       *
+ * Does nothing if the timer is not set. *
+ *****************************************/
+void wheel_clear(struct wheel *w, int id) {
+  struct wheel_node *n = &w->nodes[id];
+
+  if (n->bucket < 0) return;
+  if (n->prev >= 0) w->nodes[n->prev].next = n->next;
+  else w->heads[n->bucket] = n->next;
+  if (n->next >= 0) w->nodes[n->next].prev = n->prev;
+  if (w->heads[n->bucket] < 0) w->busy[n->bucket >> 6] &= ~(1ULL << (n->bucket & 63));
+  n->bucket = -1;
+  w->count--;
+}
+
+/*****************************************************
+ * wheel_set - Set or move a timer                   *
+ *                                                   *
+ * Deadlines already in the past go into the current *
+ * bucket so the next wheel_pop() finds them.        *
+ *****************************************************/
+void wheel_set(struct wheel *w, int id, int64_t when) {
+  struct wheel_node *n = &w->nodes[id];
+  int64_t tick = when >> WHEEL_TICK_SHIFT;
+  int b;
+
+  wheel_clear(w, id);
+  if (tick < w->tick) tick = w->tick;
+  b = tick & BUCKET_MASK;
+  n->when = when;
+  n->tick = tick;
+  n->bucket = b;
+  n->prev = -1;
+  n->next = w->heads[b];
+  if (n->next >= 0) w->nodes[n->next].prev = id;
+  w->heads[b] = id;
+  w->busy[b >> 6] |= 1ULL << (b & 63);
+  w->count++;
+}
+
+/****************************************************
+ * next_busy - Distance in buckets from bucket b to *
+ *             the next busy one, b itself included *
+ *                                                  *
+ * Returns WHEEL_BUCKETS when the wheel is empty.   *
+ ****************************************************/
+static int next_busy(const struct wheel *w, int b) {
+  uint64_t word;
+  int i, dist;
+
+  word = w->busy[b >> 6] >> (b & 63);
+  if (word) return __builtin_ctzll(word);
+  dist = 64 - (b & 63);
+  for (i = 1; i <= BUSY_WORDS; i++, dist += 64) {
+    word = w->busy[((b >> 6) + i) & (BUSY_WORDS - 1)];
+    if (word) return dist + __builtin_ctzll(word);
+  }
+  return WHEEL_BUCKETS;
+}
+
+/*****************************************************
+ * wheel_pop - Take one timer that is due by now     *
+ *                                                   *
+ * Walks the buckets from where the wheel stopped up *
+ * to now, skipping empty ones.  Timers waiting for  *
+ * a later turn of the wheel are stepped over.       *
+ * Returns the timer id, -1 when nothing is due.     *
+ *****************************************************/
+int wheel_pop(struct wheel *w, int64_t now) {
+  int64_t now_tick = now >> WHEEL_TICK_SHIFT;
+  int id, dist;
+
+  if (w->count == 0) {
+    if (now_tick > w->tick) w->tick = now_tick;
+    return -1;
+  }
+  // After a long gap one full turn visits every bucket
+  if (now_tick - w->tick >= WHEEL_BUCKETS) w->tick = now_tick - WHEEL_BUCKETS + 1;
+  for (;;) {
+    for (id = w->heads[w->tick & BUCKET_MASK]; id >= 0; id = w->nodes[id].next) {
+      if (w->nodes[id].when <= now) {
+        wheel_clear(w, id);
+        return id;
+      }
+    }
+    if (w->tick >= now_tick) return -1;
+    dist = next_busy(w, (w->tick + 1) & BUCKET_MASK) + 1;
+    w->tick = (now_tick - w->tick < dist) ? now_tick : w->tick + dist;
+  }
+}
+
+/****************************************************
+ * wheel_next - Deadline of the earliest timer      *
+ *                                                  *
+ * The first busy bucket holding a timer for the    *
+ * current turn holds the earliest one.  If every   *
+ * timer is more than a turn away, all are checked. *
+ * Returns INT64_MAX when no timer is set.          *
+ ****************************************************/
+int64_t wheel_next(const struct wheel *w) {
+  int64_t tick, when = INT64_MAX;
+  int id, dist, seen = 0;
+
+  if (w->count == 0) return INT64_MAX;
+  tick = w->tick;
+  while (seen < WHEEL_BUCKETS) {
+    dist = next_busy(w, tick & BUCKET_MASK);
+    if (dist >= WHEEL_BUCKETS - seen) break;
+    tick += dist;
+    seen += dist + 1;
+    for (id = w->heads[tick & BUCKET_MASK]; id >= 0; id = w->nodes[id].next) {
+      if (w->nodes[id].tick <= tick && w->nodes[id].when < when) when = w->nodes[id].when;
+    }
+    if (when != INT64_MAX) return when;
+    tick++;
+  }
+
+  // Everything is at least a turn away
+  for (id = 0; id < w->nnodes; id++) {
+    if (w->nodes[id].bucket >= 0 && w->nodes[id].when < when) when = w->nodes[id].when;
+  }
+  return when;
+}
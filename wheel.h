@@ -0,0 +1,59 @@
+/*********************************************************
+ * Program: tcpping - Utility for TCP based ping.        *
+ * Author:  Joseph Colton <josephcolton@gmail.com>       *
+ * License: GNU General Public License 3.0               *
+ *          https://www.gnu.org/licenses/gpl-3.0.en.html *
+ *********************************************************/
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h> // int64_t
+
+/******************************************************
+ * Wheel geometry                                     *
+ *                                                    *
+ * 65536 buckets of 65.5 us cover 4.3 s per turn.     *
+ * Anything further out waits in its bucket for later *
+ * turns, so there is no limit on how far ahead a     *
+ * timer can be set.                                  *
+ ******************************************************/
+#define WHEEL_TICK_SHIFT 16 // log2 of the bucket width in ns
+#define WHEEL_BITS       16 // log2 of the number of buckets
+#define WHEEL_BUCKETS    (1 << WHEEL_BITS)
+
+struct wheel_node {
+  int64_t when;  // Deadline on the raw clock
+  int64_t tick;  // Tick of the bucket it went into
+  int next;      // Next node in the bucket, -1 at the end
+  int prev;      // Previous node, -1 at the head
+  int bucket;    // Bucket holding the node, -1 when not set
+};
+
+/*****************************************************
+ * wheel - Hashed timing wheel                       *
+ *                                                   *
+ * Timers are identified by a small integer (a slot  *
+ * or target index) so the wheel needs no memory     *
+ * beyond what wheel_init() allocates.  Setting,     *
+ * clearing and firing a timer are O(1); a bitmap of *
+ * busy buckets lets empty stretches be skipped a    *
+ * word at a time.                                   *
+ *****************************************************/
+struct wheel {
+  struct wheel_node *nodes;  // One per timer id
+  int nnodes;                // Timer ids available
+  int count;                 // Timers set
+  int64_t tick;              // Tick the wheel has advanced to
+  int *heads;                // First node of every bucket, -1 if empty
+  uint64_t *busy;            // Bit per non-empty bucket
+};
+
+int wheel_init(struct wheel *w, int nnodes, int64_t now);
+void wheel_free(struct wheel *w);
+void wheel_set(struct wheel *w, int id, int64_t when);
+void wheel_clear(struct wheel *w, int id);
+int wheel_pop(struct wheel *w, int64_t now);
+int64_t wheel_next(const struct wheel *w);
+
+#endif